@@ -0,0 +1,141 @@
+#include "alias.h"
+#include <algorithm>
+#include <functional>
+
+AliasTable aliases;
+bool alias_expansion = false;
+
+namespace {
+
+const size_t MIN_CAPACITY = 16;
+
+size_t name_hash(std::string_view name) {
+    return std::hash<std::string_view>{}(name);
+}
+
+// Reserved words that leave the next word in command position.
+bool starts_command(std::string_view word) {
+    return word == "if" || word == "then" || word == "else" || word == "elif" || word == "while" ||
+           word == "until" || word == "do" || word == "{" || word == "!" || word == "time";
+}
+
+// Is the word after `t` in command position? `command` says whether `t` was.
+bool next_is_command(const Token& t, bool command) {
+    switch (t.kind) {
+    case TokKind::Pipe:
+    case TokKind::Amp:
+    case TokKind::Semi:
+    case TokKind::AndIf:
+    case TokKind::OrIf:
+    case TokKind::Newline: return true;
+    case TokKind::Word: return command && t.flags == 0 && starts_command(t.text);
+    case TokKind::HeredocBody: return command;
+    default: return false;  // a redirection: the next word is its target
+    }
+}
+
+struct Expander {
+    std::vector<Token>& out;
+    std::vector<std::shared_ptr<const std::string>>& keep;
+    std::vector<const Alias*> active;  // aliases being expanded, innermost last
+
+    // Append `tokens`, expanding words in command position. Returns
+    // whether the word after them is in command position.
+    bool splice(const std::vector<Token>& tokens, bool command) {
+        for (const auto& t : tokens) {
+            if (t.kind == TokKind::Word && command) {
+                command = command_word(t);
+            } else {
+                command = next_is_command(t, command);
+                out.push_back(t);
+            }
+        }
+        return command;
+    }
+
+    // Append the command word `t`, or the body of the alias it names.
+    bool command_word(const Token& t) {
+        const Alias* alias = t.flags == 0 ? aliases.find(t.text) : nullptr;
+        if (!alias || std::find(active.begin(), active.end(), alias) != active.end()) {
+            out.push_back(t);
+            return next_is_command(t, true);
+        }
+        keep.push_back(alias->body);
+        active.push_back(alias);
+        bool command = splice(alias->tokens, true) || alias->trailing_blank;
+        active.pop_back();
+        return command;
+    }
+};
+
+} // namespace
+
+void AliasTable::define(std::string_view name, std::string_view body) {
+    if ((used + 1) * 10 > slots.size() * 7) rehash(std::max(MIN_CAPACITY, slots.size() * 2));
+    Alias& alias = slots[slot_of(name)];
+    if (alias.name.empty()) {
+        alias.name = std::string(name);
+        ++used;
+    }
+    alias.body = std::make_shared<const std::string>(body);
+    lex_line(*alias.body, alias.tokens);
+    alias.trailing_blank = !body.empty() && (body.back() == ' ' || body.back() == '\t');
+}
+
+bool AliasTable::remove(std::string_view name) {
+    if (slots.empty()) return false;
+    size_t mask = slots.size() - 1;
+    size_t hole = slot_of(name);
+    if (slots[hole].name.empty()) return false;
+    slots[hole] = Alias();
+    // Backward-shift deletion: pull later entries of the probe run into the
+    // hole when that doesn't move them before their home slot
+    for (size_t j = (hole + 1) & mask; !slots[j].name.empty(); j = (j + 1) & mask) {
+        size_t home = name_hash(slots[j].name) & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            slots[hole] = std::move(slots[j]);
+            slots[j] = Alias();
+            hole = j;
+        }
+    }
+    --used;
+    return true;
+}
+
+const Alias* AliasTable::find(std::string_view name) const {
+    if (used == 0) return nullptr;
+    const Alias& alias = slots[slot_of(name)];
+    return alias.name.empty() ? nullptr : &alias;
+}
+
+std::vector<const Alias*> AliasTable::sorted() const {
+    std::vector<const Alias*> all;
+    all.reserve(used);
+    for (const auto& alias : slots)
+        if (!alias.name.empty()) all.push_back(&alias);
+    std::sort(all.begin(), all.end(), [](const Alias* a, const Alias* b) { return a->name < b->name; });
+    return all;
+}
+
+size_t AliasTable::slot_of(std::string_view name) const {
+    size_t mask = slots.size() - 1;
+    size_t i = name_hash(name) & mask;
+    while (!slots[i].name.empty() && slots[i].name != name) i = (i + 1) & mask;
+    return i;
+}
+
+void AliasTable::rehash(size_t capacity) {
+    std::vector<Alias> old(capacity);
+    old.swap(slots);
+    for (auto& alias : old)
+        if (!alias.name.empty()) slots[slot_of(alias.name)] = std::move(alias);
+}
+
+void expand_aliases(std::vector<Token>& tokens, std::vector<std::shared_ptr<const std::string>>& keep) {
+    if (aliases.size() == 0) return;
+    std::vector<Token> out;
+    out.reserve(tokens.size());
+    Expander expander{out, keep, {}};
+    expander.splice(tokens, true);
+    tokens.swap(out);
+}
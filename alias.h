@@ -0,0 +1,52 @@
+#ifndef GOONSH_ALIAS_H
+#define GOONSH_ALIAS_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "parser.h"
+
+// Aliases. Each body is lexed once, when it is defined; expanding one is a
+// splice of its tokens into the token stream of a line, with no string
+// rebuilding and no re-lexing. As in bash: only an unquoted word in
+// command position is looked up, an alias never expands inside its own
+// expansion (so `alias ls='ls -F'` works and loops stop), and a body
+// ending in a blank makes the word after it a candidate too.
+
+struct Alias {
+    std::string name;
+    // Tokens point into *body, which outlives the table entry for as long
+    // as a parsed line still holds it.
+    std::shared_ptr<const std::string> body;
+    std::vector<Token> tokens;
+    bool trailing_blank = false;
+};
+
+// Flat open-addressing table (linear probing, power-of-two capacity).
+class AliasTable {
+public:
+    void define(std::string_view name, std::string_view body);
+    bool remove(std::string_view name);
+    const Alias* find(std::string_view name) const;
+    size_t size() const { return used; }
+    // Every alias, sorted by name.
+    std::vector<const Alias*> sorted() const;
+
+private:
+    std::vector<Alias> slots;  // an empty name marks a free slot
+    size_t used = 0;
+    size_t slot_of(std::string_view name) const;
+    void rehash(size_t capacity);
+};
+
+extern AliasTable aliases;
+// Expand aliases in parsed lines; on for interactive shells only, as in bash.
+extern bool alias_expansion;
+
+// Replace every alias in command position in `tokens` with its body. The
+// bodies spliced in are appended to `keep`, which must outlive the tokens.
+void expand_aliases(std::vector<Token>& tokens, std::vector<std::shared_ptr<const std::string>>& keep);
+
+#endif // GOONSH_ALIAS_H
@@ -0,0 +1,60 @@
+#ifndef GOONSH_ARENA_H
+#define GOONSH_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for short-lived parse trees. reset() rewinds without
+// freeing, so a warmed-up arena serves every later parse without touching
+// the heap. Destructors never run, so only trivially destructible types
+// may live here; blocks come from operator new[], so alignments up to
+// __STDCPP_DEFAULT_NEW_ALIGNMENT__ are honoured.
+class Arena {
+public:
+    template <class T>
+    T* alloc(size_t n) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena never runs destructors");
+        if (n == 0) return nullptr;
+        T* p = static_cast<T*>(bump(n * sizeof(T), alignof(T)));
+        for (size_t i = 0; i < n; ++i) new (p + i) T();
+        return p;
+    }
+
+    void reset() {
+        current = 0;
+        used = 0;
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    void* bump(size_t bytes, size_t align) {
+        while (current < blocks.size()) {
+            size_t off = (used + align - 1) & ~(align - 1);
+            if (off + bytes <= blocks[current].size) {
+                used = off + bytes;
+                return blocks[current].data.get() + off;
+            }
+            ++current;
+            used = 0;
+        }
+        size_t size = blocks.empty() ? 4096 : blocks.back().size * 2;
+        while (size < bytes + align) size *= 2;
+        blocks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+        current = blocks.size() - 1;
+        used = 0;
+        return bump(bytes, align);
+    }
+
+    std::vector<Block> blocks;
+    size_t current = 0;
+    size_t used = 0;
+};
+
+#endif // GOONSH_ARENA_H
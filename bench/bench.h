@@ -0,0 +1,55 @@
+#ifndef GOONSH_BENCH_H
+#define GOONSH_BENCH_H
+
+// Tiny benchmark harness for dgsh. Each bench_*.cpp registers cases with
+// BENCH(name); bench_main.cpp runs them. Output is one tab-separated line
+// per measurement: bench, parameter, iterations, ns/op.
+//
+// Build with the dgsh_bench CMake target; `--target bench` also runs it
+// and saves the table as bench_results.tsv for comparing releases.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct BenchCase {
+    const char* name;
+    void (*fn)();
+};
+
+inline std::vector<BenchCase>& bench_registry() {
+    static std::vector<BenchCase> cases;
+    return cases;
+}
+
+struct BenchRegistrar {
+    BenchRegistrar(const char* name, void (*fn)()) { bench_registry().push_back({name, fn}); }
+};
+
+#define BENCH(name)                                                    \
+    static void bench_##name();                                        \
+    static BenchRegistrar bench_registrar_##name(#name, bench_##name); \
+    static void bench_##name()
+
+// Keep the optimizer from deleting work whose result is otherwise unused.
+template <class T>
+inline void bench_keep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Run fn() iters times and return the mean nanoseconds per call.
+template <class F>
+double bench_time(size_t iters, F&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iters; ++i) fn();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iters;
+}
+
+inline void bench_report(const char* bench, const std::string& param, size_t iters, double ns_per_op) {
+    std::printf("%s\t%s\t%zu\t%.1f\n", bench, param.c_str(), iters, ns_per_op);
+    std::fflush(stdout);
+}
+
+#endif // GOONSH_BENCH_H
@@ -0,0 +1,12 @@
+#include "bench.h"
+#include <cstring>
+
+// Usage: dgsh_bench [FILTER]  -- run every case whose name contains FILTER
+int main(int argc, char* argv[]) {
+    const char* filter = argc > 1 ? argv[1] : "";
+    std::printf("bench\tparam\titers\tns_per_op\n");
+    for (const auto& c : bench_registry()) {
+        if (std::strstr(c.name, filter)) c.fn();
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "bench.h"
+#include "cmdhash.h"
+#include "dircache.h"
+#include "fuzzy.h"
+#include "history.h"
+#include "utils.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <readline/history.h>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+std::string find_history_suggestion(const char* input);
+
+BENCH(split_line) {
+    for (size_t words : {8, 64, 512}) {
+        std::string line;
+        for (size_t i = 0; i < words; ++i) line += i % 4 ? "arg" + std::to_string(i) + " " : "\"quoted word\" | ";
+        size_t iters = 200000 / words;
+        bench_report("split", std::to_string(words) + "w", iters, bench_time(iters, [&] { bench_keep(split(line)); }));
+    }
+}
+
+// get_files() over directories with many entries: the first listing reads
+// the directory, later ones hit the cache until its mtime changes.
+BENCH(get_files_large_dir) {
+    namespace fs = std::filesystem;
+    char tmpl[] = "/tmp/dgsh-bench-XXXXXX";
+    if (!mkdtemp(tmpl)) return;
+    std::string dir = tmpl;
+    size_t created = 0;
+    for (size_t n : {1000, 10000, 100000}) {
+        for (; created < n; ++created) {
+            char name[32];
+            std::snprintf(name, sizeof(name), "/file%06zu.txt", created);
+            int fd = open((dir + name).c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+            if (fd >= 0) close(fd);
+        }
+        std::string prefix = dir + "/file0004";
+        size_t iters = n >= 100000 ? 5 : 50;
+        bench_report("get_files_cold", std::to_string(n), iters, bench_time(iters, [&] {
+            dircache_clear();
+            bench_keep(get_files(prefix));
+        }));
+        iters = 20000;
+        bench_report("get_files_warm", std::to_string(n), iters, bench_time(iters, [&] {
+            bench_keep(get_files(prefix, 64));
+        }));
+    }
+    dircache_clear();
+    fs::remove_all(dir);
+}
+
+BENCH(path_commands) {
+    size_t iters = 20;
+    bench_report("cmdhash_rescan", "PATH", iters, bench_time(iters, [] {
+        cmdhash_reset();
+        bench_keep(cmdhash_commands());
+    }));
+    iters = 20000;
+    bench_report("cmdhash_commands", "PATH", iters, bench_time(iters, [] { bench_keep(cmdhash_commands()); }));
+    bench_report("cmdhash_lookup", "ls", iters, bench_time(iters, [] { bench_keep(cmdhash_lookup("ls")); }));
+}
+
+BENCH(history_suggestion) {
+    for (size_t n : {10000, 200000}) {
+        clear_history();
+        for (size_t i = 0; i < n; ++i) {
+            std::string line = "git commit -m 'change number " + std::to_string(i) + "'";
+            add_history(line.c_str());
+        }
+        history_reindex();
+        size_t iters = 100000;
+        bench_report("find_history_suggestion", std::to_string(n), iters, bench_time(iters, [] {
+            bench_keep(find_history_suggestion("git commit -m 'change number 12"));
+        }));
+    }
+    clear_history();
+}
+
+// Ranked fuzzy completion over command-like names: most are rejected by the
+// subsequence prefilter, and only the top 100 are kept sorted.
+BENCH(fuzzy_rank) {
+    const char* parts[] = {"git", "docker", "python", "config", "x86", "lib", "tool", "ctl", "gen", "fmt"};
+    std::vector<std::string> names;
+    for (size_t i = 0; i < 100000; ++i)
+        names.push_back(std::string(parts[i % 10]) + "-" + parts[(i / 10) % 10] + "_" + std::to_string(i));
+    for (size_t n : {1000, 10000, 100000}) {
+        std::vector<std::string_view> candidates(names.begin(), names.begin() + n);
+        for (const char* pattern : {"gcf", "dockerfmt42"}) {
+            size_t iters = 2000000 / n;
+            bench_report("fuzzy_rank", std::to_string(n) + "/" + pattern, iters, bench_time(iters, [&] {
+                bench_keep(fuzzy_rank(pattern, candidates, 100));
+            }));
+        }
+    }
+    size_t iters = 1000000;
+    bench_report("fuzzy_score", "1", iters, bench_time(iters, [] {
+        bench_keep(fuzzy_score("gcfg", "git-config_generate"));
+    }));
+}
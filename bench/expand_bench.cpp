@@ -0,0 +1,79 @@
+#include "bench.h"
+#include "expand.h"
+#include "parser.h"
+#include "shell.h"
+#include "utils.h"
+#include <cstdlib>
+#include <regex>
+#include <string>
+#include <vector>
+
+// The pre-expander implementation: a fresh std::regex per call, $NAME only.
+static std::string regex_expand(const std::string& input) {
+    std::string result;
+    std::regex env_re(R"(\$([A-Za-z_][A-Za-z0-9_]*))");
+    std::sregex_iterator it(input.begin(), input.end(), env_re), end;
+    size_t last = 0;
+    for (; it != end; ++it) {
+        result += input.substr(last, it->position() - last);
+        const char* val = getenv((*it)[1].str().c_str());
+        if (val) result += val;
+        last = it->position() + it->length();
+    }
+    result += input.substr(last);
+    return result;
+}
+
+static std::vector<std::string> expansion_script(size_t nlines) {
+    static const char* templates[] = {
+        "cp $SRC/$NAME.c $DST/$NAME.o",
+        "echo building $NAME in $HOME with $DGSH_THEME",
+        "install -m 755 $DST/bin/$NAME $PREFIX/bin",
+        "echo plain line without variables at all",
+    };
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < nlines; ++i) lines.push_back(templates[i % 4]);
+    return lines;
+}
+
+BENCH(expand_vars) {
+    setenv("SRC", "/home/user/src/project", 1);
+    setenv("DST", "/home/user/build", 1);
+    setenv("NAME", "module", 1);
+    setenv("PREFIX", "/usr/local", 1);
+    auto script = expansion_script(10000);
+    std::string param = "10000lines";
+    size_t iters = 10;
+    bench_report("expand_regex", param, iters, bench_time(iters, [&] {
+        for (const auto& l : script) bench_keep(regex_expand(l));
+    }));
+    bench_report("expand_envvars", param, iters, bench_time(iters, [&] {
+        for (const auto& l : script) bench_keep(expand_envvars(l));
+    }));
+    // Full parser path: lex, expand every word, remove quotes
+    bench_report("parse_expand", param, iters, bench_time(iters, [&] {
+        for (const auto& l : script) bench_keep(parse_pipeline(l));
+    }));
+}
+
+BENCH(expand_word_forms) {
+    shell_vars["WORD"] = "value";
+    const char* words[] = {"$WORD", "\"${WORD}/x\"", "${UNSET:-fallback}", "${#WORD}", "$?", "'$WORD'"};
+    for (const char* w : words) {
+        size_t iters = 200000;
+        bench_report("expand_word", w, iters, bench_time(iters, [&] { bench_keep(expand_word(w)); }));
+    }
+}
+
+// Command substitution by how it runs: a builtin captured in-process, an
+// external command on a pipe, and a list that needs a forked subshell.
+BENCH(command_substitution) {
+    struct Case {
+        const char* word;
+        size_t iters;
+    };
+    const Case cases[] = {{"$(pwd)", 100000}, {"$(/bin/pwd)", 300}, {"$(pwd; true)", 300}};
+    for (const auto& c : cases) {
+        bench_report("subst", c.word, c.iters, bench_time(c.iters, [&] { bench_keep(expand_word(c.word)); }));
+    }
+}
@@ -0,0 +1,51 @@
+#include "bench.h"
+#include "pathglob.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Globbing a generated source tree: NDIRS directories of 100 files, two
+// levels deep. `**` walks run on the thread pool; the one-level pattern
+// is the serial path.
+BENCH(glob_tree) {
+    namespace fs = std::filesystem;
+    char tmpl[] = "/tmp/dgsh-bench-XXXXXX";
+    if (!mkdtemp(tmpl)) return;
+    std::string root = tmpl;
+    for (size_t ndirs : {20, 200}) {
+        for (size_t d = 0; d < ndirs; ++d) {
+            char dir[64];
+            std::snprintf(dir, sizeof(dir), "/mod%02zu/sub%03zu", d % 10, d);
+            fs::create_directories(root + dir);
+            for (size_t f = 0; f < 100; ++f) {
+                char name[32];
+                std::snprintf(name, sizeof(name), "/file%03zu.%s", f, f % 4 ? "cpp" : "h");
+                int fd = open((root + dir + name).c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+                if (fd >= 0) close(fd);
+            }
+        }
+        std::string param = std::to_string(ndirs * 100);
+        size_t iters = ndirs >= 200 ? 20 : 200;
+        std::vector<std::string> out;
+        bench_report("glob_recursive", param, iters, bench_time(iters, [&] {
+            out.clear();
+            glob_paths(root + "/**/*.cpp", out);
+            bench_keep(out);
+        }));
+        bench_report("glob_serial", param, iters, bench_time(iters, [&] {
+            out.clear();
+            glob_paths(root + "/mod*/sub*/*.cpp", out);
+            bench_keep(out);
+        }));
+    }
+    size_t iters = 200000;
+    bench_report("glob_match", "1", iters, bench_time(iters, [] {
+        bench_keep(glob_match("*[0-9]_test.c*", "parser_lexer_regression_4_test.cpp"));
+    }));
+    fs::remove_all(root);
+}
@@ -0,0 +1,91 @@
+#include "bench.h"
+#include "history.h"
+#include <cstdio>
+#include <readline/readline.h>
+#include <readline/history.h>
+#include <random>
+#include <string>
+#include <vector>
+
+// The pre-index suggestion lookup: newest-to-oldest walk with a copy per line.
+static std::string linear_suggestion(const std::string& prefix) {
+    HIST_ENTRY** hist = history_list();
+    if (!hist) return "";
+    for (int i = history_length - 1; i >= 0; --i) {
+        std::string h = hist[i]->line;
+        if (h.find(prefix) == 0 && h != prefix) return h.substr(prefix.size());
+    }
+    return "";
+}
+
+static std::vector<std::string> fill_history(size_t n) {
+    static const char* cmds[] = {"git commit -m", "git checkout", "ls -la", "cd src/module",
+                                 "make -j8", "grep -rn", "vim notes", "ssh host", "cat log", "docker run"};
+    std::mt19937 rng(42);
+    clear_history();
+    std::vector<std::string> lines;
+    lines.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        std::string line = cmds[rng() % 10];
+        line += " arg" + std::to_string(rng() % (n / 2 + 1));
+        add_history(line.c_str());
+        lines.push_back(line);
+    }
+    history_reindex();
+    return lines;
+}
+
+BENCH(history_prefix_lookup) {
+    for (size_t n : {1000, 10000, 100000, 200000}) {
+        auto lines = fill_history(n);
+        std::mt19937 rng(7);
+        std::vector<std::string> prefixes;
+        for (int i = 0; i < 256; ++i) {
+            const std::string& l = lines[rng() % lines.size()];
+            prefixes.push_back(l.substr(0, 1 + rng() % std::min<size_t>(l.size(), 16)));
+        }
+        size_t k = 0;
+        size_t iters = 20000;
+        double ns = bench_time(iters, [&] {
+            bench_keep(history_find_prefix(prefixes[k++ & 255], 256));
+        });
+        bench_report("history_index", std::to_string(n), iters, ns);
+        iters = n >= 100000 ? 20 : 200;
+        ns = bench_time(iters, [&] {
+            bench_keep(linear_suggestion(prefixes[k++ & 255] + "#miss"));
+        });
+        bench_report("history_linear_miss", std::to_string(n), iters, ns);
+    }
+    clear_history();
+}
+
+BENCH(history_append) {
+    fill_history(200000);
+    size_t i = 0;
+    size_t iters = 2000;
+    double ns = bench_time(iters, [&] { history_append("new command " + std::to_string(i++), false); });
+    bench_report("history_append", "200000", iters, ns);
+    clear_history();
+}
+
+// Suggestions when every line has usage statistics, so the frecency
+// bounds (not just recency) decide which blocks get scored.
+BENCH(history_frecency_lookup) {
+    clear_history();
+    history_reindex();
+    std::mt19937 rng(11);
+    static const char* cmds[] = {"git commit -m", "git checkout", "make -j8", "grep -rn", "docker run"};
+    for (size_t i = 0; i < 20000; ++i) {
+        // Skewed reuse: a few lines run often, most once
+        size_t arg = rng() % 4 ? rng() % 50 : rng() % 20000;
+        history_append(std::string(cmds[rng() % 5]) + " arg" + std::to_string(arg), false);
+    }
+    const char* prefixes[] = {"g", "git c", "make -j8 arg1", "docker run arg"};
+    for (const char* prefix : prefixes) {
+        size_t iters = 20000;
+        bench_report("history_frecency", prefix, iters, bench_time(iters, [&] {
+            bench_keep(history_find_prefix(prefix, 256));
+        }));
+    }
+    clear_history();
+}
@@ -0,0 +1,131 @@
+#include "bench.h"
+#include "alias.h"
+#include "parser.h"
+#include "script.h"
+#include <cctype>
+#include <string>
+#include <vector>
+
+// The pre-lexer pipeline: char-by-char tokenizer feeding a second pass that
+// copies every token again into CmdSegments. Kept as the baseline.
+static std::vector<std::string> legacy_tokenize(const std::string& line) {
+    std::vector<std::string> tokens;
+    std::string token;
+    bool in_single = false, in_double = false, escape = false;
+    auto flush = [&] {
+        if (!token.empty()) {
+            tokens.push_back(token);
+            token.clear();
+        }
+    };
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (escape) { token += c; escape = false; continue; }
+        if (c == '\\') { escape = true; continue; }
+        if (c == '\'' && !in_double) { in_single = !in_single; continue; }
+        if (c == '"' && !in_single) { in_double = !in_double; continue; }
+        if (!in_single && !in_double) {
+            if (isspace(static_cast<unsigned char>(c))) { flush(); continue; }
+            if (c == '<' || c == '>' || c == '|' || c == '&') {
+                flush();
+                if ((c == '<' || c == '>') && i + 1 < line.size() && line[i + 1] == c) {
+                    tokens.emplace_back(2, c);
+                    ++i;
+                } else {
+                    tokens.emplace_back(1, c);
+                }
+                continue;
+            }
+        }
+        token += c;
+    }
+    flush();
+    return tokens;
+}
+
+static std::vector<CmdSegment> legacy_parse(const std::string& line) {
+    std::vector<CmdSegment> segments;
+    CmdSegment seg;
+    auto tokens = legacy_tokenize(line);
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        const std::string& tok = tokens[i];
+        if (tok == "|") { segments.push_back(seg); seg = CmdSegment(); }
+        else if (tok == "<") { if (i + 1 < tokens.size()) seg.redirs.push_back({RedirKind::In, 0, tokens[++i]}); }
+        else if (tok == ">") { if (i + 1 < tokens.size()) seg.redirs.push_back({RedirKind::Out, 1, tokens[++i]}); }
+        else if (tok == ">>") { if (i + 1 < tokens.size()) seg.redirs.push_back({RedirKind::Append, 1, tokens[++i]}); }
+        else if (tok == "<<") { if (i + 1 < tokens.size()) seg.redirs.push_back({RedirKind::Heredoc, 0, tokens[++i]}); }
+        else if (tok == "&") seg.background = true;
+        else seg.args.push_back(tok);
+    }
+    segments.push_back(seg);
+    return segments;
+}
+
+static std::string make_line(size_t len) {
+    static const char* parts[] = {"grep -rn \"some pattern\" src/", "| sort -u", "| awk '{print $1}'",
+                                  "--flag=value", "file\\ name.txt", "> out.log", "| head -n 20"};
+    std::string line = "find . -name '*.cpp'";
+    for (size_t i = 0; line.size() < len; ++i) {
+        line += ' ';
+        line += parts[i % 7];
+    }
+    return line;
+}
+
+BENCH(parse_long_line) {
+    Parser parser;
+    for (size_t len : {100, 1000, 4000}) {
+        std::string line = make_line(len);
+        size_t iters = 400000 / len * 10;
+        std::string param = std::to_string(len) + "ch";
+        bench_report("parse_ast", param, iters, bench_time(iters, [&] { bench_keep(parser.parse(line)); }));
+        bench_report("parse_pipeline", param, iters, bench_time(iters, [&] { bench_keep(parse_pipeline(line)); }));
+        bench_report("legacy_parse", param, iters, bench_time(iters, [&] { bench_keep(legacy_parse(line)); }));
+    }
+}
+
+BENCH(parse_script) {
+    const size_t nlines = 10000;
+    std::vector<std::string> script;
+    for (size_t i = 0; i < nlines; ++i) {
+        script.push_back(i % 10 == 0 ? "# comment line " + std::to_string(i) : make_line(40 + i % 80));
+    }
+    Parser parser;
+    std::string param = std::to_string(nlines) + "lines";
+    size_t iters = 20;
+    double ns = bench_time(iters, [&] {
+        for (const auto& l : script) bench_keep(parser.parse(l));
+    });
+    bench_report("script_parse_ast", param, iters, ns);
+    ns = bench_time(iters, [&] {
+        for (const auto& l : script) bench_keep(parse_pipeline(l));
+    });
+    bench_report("script_parse_pipeline", param, iters, ns);
+    ns = bench_time(iters, [&] {
+        for (const auto& l : script) {
+            if (l.empty() || l[0] == '#') continue;
+            bench_keep(legacy_parse(l));
+        }
+    });
+    bench_report("script_legacy_parse", param, iters, ns);
+}
+
+BENCH(alias_expand) {
+    const std::string line = "ll -a src | g TODO | s -u | h -n 20";
+    const size_t iters = 200000;
+    alias_expansion = false;
+    bench_report("script_parse", "no_aliases", iters, bench_time(iters, [&] { bench_keep(script_parse(line, "")); }));
+    alias_expansion = true;
+    // A realistic rc file's worth of aliases, none of which the line uses
+    for (int i = 0; i < 200; ++i) aliases.define("alias" + std::to_string(i), "echo " + std::to_string(i));
+    bench_report("script_parse", "200_aliases_miss", iters,
+                 bench_time(iters, [&] { bench_keep(script_parse(line, "")); }));
+    aliases.define("ll", "ls -l ");
+    aliases.define("ls", "ls --color=auto");
+    aliases.define("g", "grep -n");
+    aliases.define("s", "sort");
+    aliases.define("h", "head");
+    bench_report("script_parse", "200_aliases_5_spliced", iters,
+                 bench_time(iters, [&] { bench_keep(script_parse(line, "")); }));
+    alias_expansion = false;
+}
@@ -0,0 +1,344 @@
+#include "bench.h"
+#include "jobs.h"
+#include "servemsg.h"
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+extern char** environ;
+
+#ifndef DGSH_BENCH_SHELL
+#define DGSH_BENCH_SHELL "./dgsh"
+#endif
+#ifndef DGSH_BENCH_CLIENT
+#define DGSH_BENCH_CLIENT "./dgsh-client"
+#endif
+
+// End to end: `dgsh script.sh` from exec to exit, stdout to /dev/null, in
+// a scratch $HOME so no ~/.dgshrc or history gets involved. ns_per_op is
+// per script line, so startup cost is amortized over the script.
+
+// Our environment with $HOME replaced; `home_env` backs the new entry.
+static std::vector<char*> bench_env(const std::string& home, std::string& home_env) {
+    home_env = "HOME=" + home;
+    std::vector<char*> env;
+    for (char** e = environ; *e; ++e)
+        if (std::string(*e).rfind("HOME=", 0) != 0) env.push_back(*e);
+    env.push_back(&home_env[0]);
+    env.push_back(nullptr);
+    return env;
+}
+
+// The binary at $`var`, else at `fallback`. Empty, with a message for
+// `bench`, if it isn't there to run.
+static std::string bench_binary(const char* bench, const char* what, const char* var, const char* fallback) {
+    const char* override = getenv(var);
+    std::string path = override ? override : fallback;
+    if (access(path.c_str(), X_OK) == 0) return path;
+    std::fprintf(stderr, "%s: no %s at %s (set %s)\n", bench, what, path.c_str(), var);
+    return {};
+}
+
+static std::string bench_shell(const char* bench) {
+    return bench_binary(bench, "dgsh", "DGSH_BENCH_SHELL", DGSH_BENCH_SHELL);
+}
+
+// A fresh $HOME under /tmp, removed with all it holds when this goes out
+// of scope. `path` is empty if it couldn't be made.
+struct ScratchHome {
+    std::string path;
+    ScratchHome() {
+        char tmpl[] = "/tmp/dgsh-bench-XXXXXX";
+        if (mkdtemp(tmpl)) path = tmpl;
+    }
+    ~ScratchHome() {
+        if (!path.empty()) std::filesystem::remove_all(path);
+    }
+    ScratchHome(const ScratchHome&) = delete;
+    ScratchHome& operator=(const ScratchHome&) = delete;
+};
+
+// `dgsh ARGS...` with stdin from `input`; wall time in ns, or -1.
+static double run_shell(const std::string& shell, const std::string& home, std::vector<const char*> argv,
+                        const char* input = "/dev/null") {
+    std::string home_env;
+    std::vector<char*> env = bench_env(home, home_env);
+    argv.insert(argv.begin(), "dgsh");
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, input, O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid;
+    int err = posix_spawn(&pid, shell.c_str(), &actions, nullptr, const_cast<char**>(argv.data()), env.data());
+    posix_spawn_file_actions_destroy(&actions);
+    if (err) return -1;
+    int status = wait_child(pid);
+    auto end = std::chrono::steady_clock::now();
+    if (status < 0 || !WIFEXITED(status)) return -1;
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+static double run_script(const std::string& shell, const std::string& home, const std::string& script) {
+    return run_shell(shell, home, {script.c_str()});
+}
+
+BENCH(script_throughput) {
+    std::string shell = bench_shell("script_throughput");
+    ScratchHome scratch;
+    if (shell.empty() || scratch.path.empty()) return;
+    const std::string& home = scratch.path;
+
+    struct Workload {
+        const char* name;
+        std::vector<const char*> lines;
+        size_t repeat;
+    };
+    const Workload workloads[] = {
+        {"builtins", {"export N=1", "echo line $N ${N:-x} ${#HOME}", "cd /tmp", "pwd", "true"}, 2000},
+        {"external", {"/bin/true", "true | true"}, 200},
+        {"mixed", {"echo start", "ls / | wc -l", "cd /", "true", "which ls"}, 200},
+        // Ten function calls per line, run from the parsed tree
+        {"loop", {"f() { N=$1; echo $N && true; }", "for i in 0 1 2 3 4 5 6 7 8 9; do f $i; done"}, 500},
+    };
+    for (const auto& w : workloads) {
+        std::string script = home + "/" + w.name + ".sh";
+        std::ofstream out(script);
+        for (size_t i = 0; i < w.repeat; ++i)
+            for (const char* line : w.lines) out << line << '\n';
+        out.close();
+        size_t nlines = w.repeat * w.lines.size();
+        const size_t runs = 5;
+        double total = 0;
+        for (size_t r = 0; r < runs; ++r) {
+            double ns = run_script(shell, home, script);
+            if (ns < 0) {
+                std::fprintf(stderr, "script_throughput: %s failed\n", w.name);
+                total = -1;
+                break;
+            }
+            total += ns;
+        }
+        if (total > 0) bench_report("script_e2e", w.name, runs * nlines, total / (runs * nlines));
+    }
+    // Startup and exit alone
+    std::string empty = home + "/empty.sh";
+    std::ofstream(empty).close();
+    const size_t runs = 50;
+    double total = 0;
+    for (size_t r = 0; r < runs && total >= 0; ++r) {
+        double ns = run_script(shell, home, empty);
+        total = ns < 0 ? -1 : total + ns;
+    }
+    if (total > 0) bench_report("script_startup", "empty", runs, total / runs);
+}
+
+// Interactive startup: exec to the first prompt on a terminal, in ns, or
+// -1 on failure. The ~/.dgshrc in `home` sets the prompt to READY>.
+static double first_prompt(const std::string& shell, const std::string& home) {
+    std::string home_env;
+    std::vector<char*> env = bench_env(home, home_env);
+    int master;
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = forkpty(&master, nullptr, nullptr, nullptr);
+    if (pid == 0) {
+        const char* argv[] = {"dgsh", nullptr};
+        execve(shell.c_str(), const_cast<char**>(argv), env.data());
+        _exit(127);
+    }
+    if (pid < 0) return -1;
+    // The prompt is the last thing written before dgsh waits for a key
+    std::string out;
+    double ns = -1;
+    char buf[4096];
+    struct pollfd pfd = {master, POLLIN, 0};
+    while (poll(&pfd, 1, 5000) > 0) {
+        ssize_t n = read(master, buf, sizeof(buf));
+        if (n <= 0) break;
+        out.append(buf, n);
+        if (out.find("READY>") != std::string::npos) {
+            ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            break;
+        }
+    }
+    if (write(master, "exit\n", 5) != 5) ns = -1;
+    // Drain until dgsh is gone so it never blocks on a full terminal
+    while (poll(&pfd, 1, 5000) > 0 && read(master, buf, sizeof(buf)) > 0) {
+    }
+    close(master);
+    wait_child(pid);
+    return ns;
+}
+
+BENCH(startup) {
+    std::string shell = bench_shell("startup");
+    ScratchHome scratch;
+    if (shell.empty() || scratch.path.empty()) return;
+    const std::string& home = scratch.path;
+    std::ofstream(home + "/.dgshrc") << "prompt=READY> \n";
+
+    const size_t runs = 30;
+    for (size_t lines : {0, 100000}) {
+        std::ofstream hist(home + "/.dgsh_history");
+        for (size_t i = 0; i < lines; ++i) hist << "#" << 1700000000 + i << "\ngit commit -m 'change " << i << "'\n";
+        hist.close();
+        std::filesystem::remove(home + "/.dgsh_history.stats");
+        double total = 0;
+        for (size_t r = 0; r < runs && total >= 0; ++r) {
+            double ns = first_prompt(shell, home);
+            total = ns < 0 ? -1 : total + ns;
+        }
+        if (total > 0) bench_report("startup_first_prompt", std::to_string(lines) + "_history", runs, total / runs);
+    }
+
+    // Exec to exit for one command read from stdin (not a terminal), and
+    // for -c strings: a builtin, and external commands, where the last one
+    // replaces the shell instead of being waited for
+    std::string input = home + "/true.txt";
+    std::ofstream(input) << "true\n";
+    struct Case {
+        const char* name;
+        std::vector<const char*> args;
+        const char* input;
+    };
+    const Case cases[] = {
+        {"stdin_true", {}, input.c_str()},
+        {"c_true", {"-c", "true"}, "/dev/null"},
+        {"c_exec_ls", {"-c", "ls /"}, "/dev/null"},
+        {"c_ls_ls", {"-c", "ls /; ls /"}, "/dev/null"},
+    };
+    for (const auto& c : cases) {
+        double total = 0;
+        for (size_t r = 0; r < runs && total >= 0; ++r) {
+            double ns = run_shell(shell, home, c.args, c.input);
+            total = ns < 0 ? -1 : total + ns;
+        }
+        if (total > 0) bench_report("startup_exit", c.name, runs, total / runs);
+    }
+}
+
+// Commands through `dgsh --serve` against a dgsh started for each: a
+// dgsh-client process per command, requests made from here one at a
+// time, and 16 at once. ns_per_op is per command.
+BENCH(serve) {
+    std::string shell = bench_shell("serve");
+    std::string client = bench_binary("serve", "dgsh-client", "DGSH_BENCH_CLIENT", DGSH_BENCH_CLIENT);
+    ScratchHome scratch;
+    if (shell.empty() || client.empty() || scratch.path.empty()) return;
+    const std::string& home = scratch.path;
+    std::string sock = home + "/sock";
+
+    std::string home_env;
+    std::vector<char*> env = bench_env(home, home_env);
+    const char* argv[] = {"dgsh", "--serve", sock.c_str(), nullptr};
+    pid_t server;
+    if (posix_spawn(&server, shell.c_str(), nullptr, nullptr, const_cast<char**>(argv), env.data()) != 0) return;
+    int probe = -1;
+    for (int i = 0; i < 200 && probe < 0; ++i) {
+        probe = serve_connect(sock);
+        if (probe < 0) usleep(10000);
+    }
+    if (probe < 0) {
+        kill(server, SIGTERM);
+        wait_child(server);
+        return;
+    }
+    close(probe);
+
+    int devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+    const int fds[3] = {devnull, devnull, devnull};
+    auto request = [&](const char* command, size_t n) {
+        std::vector<int> socks;
+        for (size_t i = 0; i < n; ++i) {
+            int s = serve_connect(sock);
+            ServeRequest req;
+            req.command = command;
+            if (s >= 0 && serve_send(s, req, fds)) socks.push_back(s);
+            else if (s >= 0) close(s);
+        }
+        bool ok = socks.size() == n;
+        for (int s : socks) {
+            ok = serve_wait(s) == 0 && ok;
+            close(s);
+        }
+        return ok;
+    };
+
+    const size_t runs = 100;
+    for (const char* command : {"true", "/bin/true"}) {
+        std::string name = command[0] == '/' ? "bin_true" : "true";
+        double total = 0;
+        for (size_t r = 0; r < runs && total >= 0; ++r) {
+            double ns = run_shell(shell, home, {"-c", command});
+            total = ns < 0 ? -1 : total + ns;
+        }
+        if (total > 0) bench_report("serve", name + "_dgsh_per_command", runs, total / runs);
+        total = 0;
+        for (size_t r = 0; r < runs && total >= 0; ++r) {
+            double ns = run_shell(client, home, {sock.c_str(), command});
+            total = ns < 0 ? -1 : total + ns;
+        }
+        if (total > 0) bench_report("serve", name + "_client_per_command", runs, total / runs);
+        bool ok = true;
+        double ns = bench_time(runs, [&] { ok = request(command, 1) && ok; });
+        if (ok) bench_report("serve", name + "_request", runs, ns);
+        ns = bench_time(runs / 4, [&] { ok = request(command, 16) && ok; }) / 16;
+        if (ok) bench_report("serve", name + "_16_concurrent", runs / 4 * 16, ns);
+    }
+    close(devnull);
+    kill(server, SIGTERM);
+    wait_child(server);
+}
+
+// `cat FILE | wc -c` and `cat FILE > copy` through `dgsh -c`, with the
+// in-process cat against /bin/cat, for a 64 MiB file and a 4 KiB one.
+// ns_per_op is per command line, shell startup included.
+BENCH(cat) {
+    std::string shell = bench_shell("cat");
+    ScratchHome scratch;
+    if (shell.empty() || scratch.path.empty()) return;
+    const std::string& home = scratch.path;
+    std::string line(63, 'x');
+    line += '\n';
+    {
+        std::ofstream big(home + "/big.log");
+        for (size_t i = 0; i < (64 << 20) / line.size(); ++i) big << line;
+        std::ofstream small(home + "/small.log");
+        for (size_t i = 0; i < 4096 / line.size(); ++i) small << line;
+    }
+    struct Case {
+        const char* file;
+        size_t runs;
+    };
+    for (const Case& c : {Case{"big", 10}, Case{"small", 50}}) {
+        std::string path = home + "/" + c.file + ".log";
+        for (const char* cat : {"cat", "/bin/cat"}) {
+            std::string impl = cat[0] == '/' ? "external" : "builtin";
+            const std::string commands[][2] = {
+                {"pipe", std::string(cat) + " " + path + " | wc -c"},
+                {"file", std::string(cat) + " " + path + " > " + home + "/copy"},
+            };
+            for (const auto& command : commands) {
+                double total = 0;
+                for (size_t r = 0; r < c.runs && total >= 0; ++r) {
+                    double ns = run_shell(shell, home, {"-c", command[1].c_str()});
+                    total = ns < 0 ? -1 : total + ns;
+                }
+                std::string name = std::string(c.file) + "_" + command[0] + "_" + impl;
+                if (total > 0) bench_report("cat", name, c.runs, total / c.runs);
+            }
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#include "bench.h"
+#include "exec.h"
+#include "history.h"
+#include "parallel.h"
+#include "parser.h"
+#include <cstring>
+#include <readline/readline.h>
+#include <readline/history.h>
+#include <string>
+#include <vector>
+
+// Launch cost of `true`, spawn vs fork, as the shell's RSS grows
+// (commands per second = 1e9 / ns_per_op).
+static void run_true_loop(const std::string& param) {
+    auto segments = parse_pipeline("true");
+    for (bool spawn : {true, false}) {
+        exec_use_spawn = spawn;
+        size_t iters = 300;
+        double ns = bench_time(iters, [&] {
+            auto segs = segments;
+            bench_keep(run_pipeline(segs));
+        });
+        bench_report(spawn ? "spawn_true" : "fork_true", param, iters, ns);
+    }
+    exec_use_spawn = true;
+}
+
+BENCH(spawn_latency) {
+    run_true_loop("fresh");
+
+    clear_history();
+    for (int i = 0; i < 200000; ++i) {
+        std::string line = "some previously typed command --with args " + std::to_string(i);
+        add_history(line.c_str());
+    }
+    history_reindex();
+    // Stand-in for completion caches and other long-session growth
+    const size_t ballast_mb = 256;
+    std::vector<char> ballast(ballast_mb << 20);
+    memset(ballast.data(), 1, ballast.size());
+    run_true_loop("history200k+256MB");
+    bench_keep(ballast);
+    clear_history();
+}
+
+// `parallel` overhead: ns per job for 200 `true` jobs, 4 in flight, with
+// output grouped (a pipe pair per job) and streamed.
+BENCH(parallel_throughput) {
+    std::vector<std::string> command = {"true"};
+    for (bool ordered : {true, false}) {
+        ParallelOptions options;
+        options.jobs = 4;
+        options.ordered = ordered;
+        size_t iters = 5;
+        const size_t njobs = 200;
+        double ns = bench_time(iters, [&] {
+            size_t left = njobs;
+            auto items = [&](std::string& item) {
+                if (left == 0) return false;
+                item = std::to_string(left--);
+                return true;
+            };
+            bench_keep(parallel_run(command, items, options));
+        });
+        bench_report("parallel_true", ordered ? "grouped" : "ungrouped", iters * njobs, ns / njobs);
+    }
+}
+
+// A builtin stage in a pipeline runs in the shell: `echo | cat` spawns one
+// process where `/bin/echo | cat` spawns two. Output goes to /dev/null.
+BENCH(builtin_pipeline) {
+    for (const char* line : {"echo hi | cat > /dev/null", "/bin/echo hi | cat > /dev/null"}) {
+        auto segments = parse_pipeline(line);
+        size_t iters = 300;
+        double ns = bench_time(iters, [&] {
+            auto segs = segments;
+            bench_keep(run_pipeline(segs));
+        });
+        bench_report("pipeline_echo_cat", line[0] == '/' ? "external" : "builtin", iters, ns);
+    }
+}
@@ -0,0 +1,519 @@
+#include "builtins.h"
+#include "alias.h"
+#include "cat.h"
+#include "cmdhash.h"
+#include "exec.h"
+#include "history.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "prompt.h"
+#include "shell.h"
+#include "trace.h"
+#include <readline/readline.h>
+#include <readline/history.h>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+extern char** environ;
+
+// `cd [DIR|-]`
+static int builtin_cd(const std::vector<std::string>& args) {
+    std::string target;
+    if (args.size() > 1 && args[1] == "-") {
+        const char* old = getenv("OLDPWD");
+        if (!old) {
+            std::cerr << "cd: OLDPWD not set" << std::endl;
+            return 1;
+        }
+        target = old;
+        std::cout << target << std::endl;
+    } else if (args.size() > 1) {
+        target = args[1];
+    } else {
+        const char* home = getenv("HOME");
+        target = home ? home : "/";
+    }
+    char cwd[PATH_MAX];
+    bool have_cwd = getcwd(cwd, sizeof(cwd)) != nullptr;
+    if (chdir(target.c_str()) != 0) {
+        perror("cd");
+        return 1;
+    }
+    if (have_cwd) setenv("OLDPWD", cwd, 1);
+    if (getcwd(cwd, sizeof(cwd))) setenv("PWD", cwd, 1);
+    prompt_cwd_changed();
+    history_cwd_changed();
+    return 0;
+}
+
+// `pwd`
+static int builtin_pwd(const std::vector<std::string>& /*args*/) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        perror("pwd");
+        return 1;
+    }
+    std::cout << cwd << std::endl;
+    return 0;
+}
+
+// `echo [-neE] [ARG...]`
+static int builtin_echo(const std::vector<std::string>& args) {
+    bool newline = true, escapes = false;
+    size_t i = 1;
+    for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-' &&
+           args[i].find_first_not_of("neE", 1) == std::string::npos;
+         ++i) {
+        for (char c : args[i].substr(1)) {
+            if (c == 'n') newline = false;
+            else if (c == 'e') escapes = true;
+            else escapes = false;
+        }
+    }
+    std::string out;
+    for (size_t first = i; i < args.size(); ++i) {
+        if (i > first) out += ' ';
+        if (!escapes) {
+            out += args[i];
+            continue;
+        }
+        const std::string& a = args[i];
+        for (size_t j = 0; j < a.size(); ++j) {
+            if (a[j] != '\\' || j + 1 == a.size()) {
+                out += a[j];
+                continue;
+            }
+            switch (a[++j]) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case 'a': out += '\a'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'v': out += '\v'; break;
+            case 'e': out += '\033'; break;
+            case '\\': out += '\\'; break;
+            case 'c':
+                std::cout << out << std::flush;
+                return 0;
+            default:
+                out += '\\';
+                out += a[j];
+            }
+        }
+    }
+    if (newline) out += '\n';
+    std::cout << out << std::flush;
+    return 0;
+}
+
+// `export [NAME[=VALUE]...]`
+static int builtin_export(const std::vector<std::string>& args) {
+    if (args.size() == 1) {
+        for (char** e = environ; *e; ++e) {
+            std::string entry = *e;
+            auto eq = entry.find('=');
+            std::cout << "export " << entry.substr(0, eq) << "=\"" << entry.substr(eq + 1) << "\"" << std::endl;
+        }
+        return 0;
+    }
+    for (size_t i = 1; i < args.size(); ++i) {
+        auto eq = args[i].find('=');
+        std::string name = args[i].substr(0, eq);
+        if (name.empty()) {
+            std::cerr << "export: `" << args[i] << "': not a valid identifier" << std::endl;
+            return 1;
+        }
+        auto var = shell_vars.find(name);
+        if (eq != std::string::npos) {
+            setenv(name.c_str(), args[i].c_str() + eq + 1, 1);
+        } else if (var != shell_vars.end()) {
+            setenv(name.c_str(), var->second.c_str(), 1);
+        } else {
+            continue;
+        }
+        // Exported variables live in the environment only, so children see
+        // the same value the shell does.
+        if (var != shell_vars.end()) shell_vars.erase(var);
+    }
+    return 0;
+}
+
+// `unset NAME...`
+static int builtin_unset(const std::vector<std::string>& args) {
+    for (size_t i = 1; i < args.size(); ++i) {
+        auto var = shell_vars.find(args[i]);
+        if (var != shell_vars.end()) shell_vars.erase(var);
+        unsetenv(args[i].c_str());
+    }
+    return 0;
+}
+
+// `exit [N]` / `quit [N]`
+static int builtin_exit(const std::vector<std::string>& args) {
+    shell_exiting = true;
+    return args.size() > 1 ? atoi(args[1].c_str()) & 0xff : last_status;
+}
+
+// `help`
+static int builtin_help(const std::vector<std::string>& /*args*/) {
+    std::cout << "Available commands:\n";
+    for (const auto& b : builtins) std::cout << "  " << b << std::endl;
+    return 0;
+}
+
+// `history [N]`
+static int builtin_history(const std::vector<std::string>& args) {
+    history_wait();
+    HIST_ENTRY** hist = history_list();
+    if (!hist) return 0;
+    int start = 0;
+    if (args.size() > 1) start = std::max(0, history_length - atoi(args[1].c_str()));
+    for (int i = start; i < history_length; ++i) {
+        std::cout << std::setw(5) << i + history_base << "  " << hist[i]->line << "\n";
+    }
+    std::cout << std::flush;
+    return 0;
+}
+
+// `alias [NAME[=VALUE]...]`
+static int builtin_alias(const std::vector<std::string>& args) {
+    if (args.size() == 1) {
+        for (const Alias* a : aliases.sorted()) std::cout << "alias " << a->name << "='" << *a->body << "'" << std::endl;
+        return 0;
+    }
+    int status = 0;
+    for (size_t i = 1; i < args.size(); ++i) {
+        auto eq = args[i].find('=');
+        if (eq != std::string::npos) {
+            aliases.define(std::string_view(args[i]).substr(0, eq), std::string_view(args[i]).substr(eq + 1));
+            continue;
+        }
+        const Alias* alias = aliases.find(args[i]);
+        if (!alias) {
+            std::cerr << "alias: " << args[i] << ": not found" << std::endl;
+            status = 1;
+        } else {
+            std::cout << "alias " << alias->name << "='" << *alias->body << "'" << std::endl;
+        }
+    }
+    return status;
+}
+
+// `unalias NAME...`
+static int builtin_unalias(const std::vector<std::string>& args) {
+    int status = 0;
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (!aliases.remove(args[i])) {
+            std::cerr << "unalias: " << args[i] << ": not found" << std::endl;
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// `hash [-r] [NAME...]`: show or reset the command hash
+static int builtin_hash(const std::vector<std::string>& args) {
+    if (args.size() == 1) {
+        auto entries = cmdhash_remembered();
+        if (entries.empty()) {
+            std::cout << "hash: hash table empty" << std::endl;
+            return 0;
+        }
+        std::cout << "hits\tcommand" << std::endl;
+        for (const auto& e : entries) std::cout << std::setw(4) << e.first << "\t" << e.second << std::endl;
+        return 0;
+    }
+    int status = 0;
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (args[i] == "-r") {
+            cmdhash_reset();
+        } else if (cmdhash_lookup(args[i]).empty()) {
+            std::cerr << "hash: " << args[i] << ": not found" << std::endl;
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// `which NAME...`: print where each command resolves to
+static int builtin_which(const std::vector<std::string>& args) {
+    int status = 0;
+    for (size_t i = 1; i < args.size(); ++i) {
+        const std::string& name = args[i];
+        if (const Alias* alias = aliases.find(name)) {
+            std::cout << name << ": aliased to " << *alias->body << std::endl;
+            continue;
+        }
+        if (find_builtin(name)) {
+            std::cout << name << ": shell builtin" << std::endl;
+            continue;
+        }
+        std::string path = name.find('/') != std::string::npos ? name : cmdhash_lookup(name);
+        if (!path.empty() && access(path.c_str(), X_OK) == 0) {
+            std::cout << path << std::endl;
+        } else {
+            std::cerr << "which: no " << name << " in PATH" << std::endl;
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// `jobs [-lp]`
+static int builtin_jobs(const std::vector<std::string>& args) {
+    bool pids_only = false, long_format = false;
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (args[i] == "-p") pids_only = true;
+        else if (args[i] == "-l") long_format = true;
+        else {
+            std::cerr << "jobs: usage: jobs [-lp]" << std::endl;
+            return 2;
+        }
+    }
+    jobs_list(pids_only, long_format);
+    return 0;
+}
+
+// `fg [%N]`
+static int builtin_fg(const std::vector<std::string>& args) {
+    Job* job = job_find(args.size() > 1 ? args[1] : "", "fg");
+    return job ? job_foreground(job) : 1;
+}
+
+// `bg [%N...]`
+static int builtin_bg(const std::vector<std::string>& args) {
+    if (args.size() == 1) {
+        Job* job = job_find("", "bg");
+        return job ? job_background(job) : 1;
+    }
+    int status = 0;
+    for (size_t i = 1; i < args.size(); ++i) {
+        Job* job = job_find(args[i], "bg");
+        if (job) job_background(job);
+        else status = 1;
+    }
+    return status;
+}
+
+// `wait [%N|PID...]`: no arguments waits for every job
+static int builtin_wait(const std::vector<std::string>& args) {
+    if (args.size() == 1) return jobs_wait_all();
+    int status = 0;
+    for (size_t i = 1; i < args.size(); ++i) {
+        Job* job = job_find(args[i], "wait");
+        status = job ? job_wait(job, false) : 127;
+    }
+    return status;
+}
+
+// `parallel [-j N] [-u] [-v] COMMAND [ARG...] [::: ITEM...]`: run COMMAND
+// once per item (the lines of stdin without :::), N at a time
+static int builtin_parallel(const std::vector<std::string>& args) {
+    ParallelOptions options;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    options.jobs = cpus > 0 ? cpus : 1;
+    size_t i = 1;
+    for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; ++i) {
+        const std::string& opt = args[i];
+        if (opt == "--") {
+            ++i;
+            break;
+        }
+        if (opt == "-u") {
+            options.ordered = false;
+        } else if (opt == "-k") {
+            options.ordered = true;
+        } else if (opt == "-v") {
+            options.verbose = true;
+        } else if (opt.compare(0, 2, "-j") == 0) {
+            std::string n = opt.size() > 2 ? opt.substr(2) : i + 1 < args.size() ? args[++i] : "";
+            char* end = nullptr;
+            long jobs = strtol(n.c_str(), &end, 10);
+            if (n.empty() || *end || jobs < 1) {
+                std::cerr << "parallel: " << n << ": invalid job count" << std::endl;
+                return 2;
+            }
+            options.jobs = jobs;
+        } else {
+            std::cerr << "parallel: " << opt << ": invalid option" << std::endl;
+            return 2;
+        }
+    }
+    std::vector<std::string> command;
+    for (; i < args.size() && args[i] != ":::"; ++i) command.push_back(args[i]);
+    if (command.empty()) {
+        std::cerr << "usage: parallel [-j N] [-u] [-v] COMMAND [ARG...] [::: ITEM...]" << std::endl;
+        return 2;
+    }
+    if (i < args.size()) {
+        size_t next = i + 1;
+        auto from_args = [&](std::string& item) {
+            if (next >= args.size()) return false;
+            item = args[next++];
+            return true;
+        };
+        return parallel_run(command, from_args, options);
+    }
+    // Items are read as jobs free up, so a slow producer doesn't hold back
+    // the first ones
+    std::string pending;
+    size_t pos = 0;
+    bool eof = false;
+    auto from_stdin = [&](std::string& item) {
+        for (;;) {
+            size_t nl = pending.find('\n', pos);
+            if (nl != std::string::npos || (eof && pos < pending.size())) {
+                size_t end = nl != std::string::npos ? nl : pending.size();
+                item.assign(pending, pos, end - pos);
+                pos = end + 1;
+                if (!item.empty()) return true;
+                continue;
+            }
+            if (eof) return false;
+            pending.erase(0, pos);
+            pos = 0;
+            char buf[4096];
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            // ^C (EINTR) ends the input like end of file
+            if (n <= 0) eof = true;
+            else pending.append(buf, n);
+        }
+    };
+    return parallel_run(command, from_stdin, options);
+}
+
+static int builtin_true(const std::vector<std::string>& /*args*/) {
+    return 0;
+}
+
+static int builtin_false(const std::vector<std::string>& /*args*/) {
+    return 1;
+}
+
+// --- Dispatch table ---
+
+namespace {
+
+struct BuiltinDef {
+    std::string_view name;
+    BuiltinFn fn;
+};
+
+constexpr BuiltinDef builtin_defs[] = {
+    {"cd", builtin_cd},           {"pwd", builtin_pwd},         {"echo", builtin_echo},
+    {"export", builtin_export},   {"unset", builtin_unset},     {"exit", builtin_exit},
+    {"quit", builtin_exit},       {"help", builtin_help},       {"history", builtin_history},
+    {"alias", builtin_alias},     {"unalias", builtin_unalias}, {"hash", builtin_hash},
+    {"which", builtin_which},     {"true", builtin_true},       {"false", builtin_false},
+    {"jobs", builtin_jobs},       {"fg", builtin_fg},           {"bg", builtin_bg},
+    {"wait", builtin_wait},       {"parallel", builtin_parallel},
+};
+
+constexpr size_t NUM_BUILTINS = sizeof(builtin_defs) / sizeof(builtin_defs[0]);
+constexpr size_t TABLE_SIZE = 64;  // power of two, comfortably above NUM_BUILTINS
+static_assert(NUM_BUILTINS * 2 <= TABLE_SIZE, "grow TABLE_SIZE");
+
+constexpr uint32_t name_hash(std::string_view s, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (char c : s) h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+constexpr bool seed_is_perfect(uint32_t seed) {
+    bool used[TABLE_SIZE] = {};
+    for (const auto& d : builtin_defs) {
+        uint32_t slot = name_hash(d.name, seed) & (TABLE_SIZE - 1);
+        if (used[slot]) return false;
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t find_seed() {
+    uint32_t seed = 0;
+    while (!seed_is_perfect(seed)) ++seed;
+    return seed;
+}
+
+constexpr uint32_t SEED = find_seed();
+
+struct SlotTable {
+    int8_t slot[TABLE_SIZE];
+};
+
+constexpr SlotTable build_slots() {
+    SlotTable t = {};
+    for (auto& s : t.slot) s = -1;
+    for (size_t i = 0; i < NUM_BUILTINS; ++i) {
+        t.slot[name_hash(builtin_defs[i].name, SEED) & (TABLE_SIZE - 1)] = static_cast<int8_t>(i);
+    }
+    return t;
+}
+
+constexpr SlotTable slots = build_slots();
+
+} // namespace
+
+BuiltinFn find_builtin(std::string_view name) {
+    int8_t i = slots.slot[name_hash(name, SEED) & (TABLE_SIZE - 1)];
+    if (i < 0 || builtin_defs[i].name != name) return nullptr;
+    return builtin_defs[i].fn;
+}
+
+bool is_pure_builtin(std::string_view name, size_t nwords) {
+    if (name == "echo" || name == "pwd" || name == "which" || name == "true" || name == "false" ||
+        name == "help" || name == "history" || name == "jobs")
+        return true;
+    return (name == "alias" || name == "hash") && nwords == 1;
+}
+
+bool run_builtin(const CmdSegment& seg, int& status, int in, int out) {
+    if (seg.args.empty()) return false;
+    BuiltinFn fn = find_builtin(seg.args[0]);
+    if (!fn && cat_in_process(seg.args)) fn = cat_run;
+    if (!fn) return false;
+    TraceSpan span("builtin");
+
+    // The pipes first, then the stage's own redirections, which win
+    std::vector<FdAction> actions;
+    std::vector<int> opened;
+    if (in != -1) actions.push_back({STDIN_FILENO, in});
+    if (out != -1) actions.push_back({STDOUT_FILENO, out});
+    bool ok = seg.redirs.empty() || stage_redirections(seg, actions, opened);
+    std::cout.flush();
+    std::cerr.flush();
+    // Every fd touched is saved above 9 (-1: it was closed) and put back after
+    std::vector<std::pair<int, int>> saved;
+    for (size_t i = 0; ok && i < actions.size(); ++i) {
+        const FdAction& a = actions[i];
+        saved.emplace_back(a.to, fcntl(a.to, F_DUPFD_CLOEXEC, 10));
+        if (a.from == -1) close(a.to);
+        else if (a.from != a.to) dup2(a.from, a.to);
+    }
+    for (int fd : opened) close(fd);
+
+    status = ok ? fn(seg.args) : 1;
+
+    std::cout.flush();
+    std::cerr.flush();
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+        if (it->second == -1) {
+            close(it->first);
+            continue;
+        }
+        dup2(it->second, it->first);
+        close(it->second);
+    }
+    return true;
+}
@@ -0,0 +1,31 @@
+#ifndef GOONSH_BUILTINS_H
+#define GOONSH_BUILTINS_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "parser.h"
+
+// Commands that run inside the shell process. Lookup goes through a
+// perfect hash computed at compile time, so dispatch is one hash and one
+// string compare no matter how many builtins there are.
+
+using BuiltinFn = int (*)(const std::vector<std::string>& args);
+
+// Implementation for `name`, or nullptr if it isn't an in-process builtin.
+BuiltinFn find_builtin(std::string_view name);
+
+// Builtins that only read shell state, so running them in the shell
+// process is the same as running them in a subshell. alias and hash
+// change things when given arguments; `nwords` counts the name too.
+bool is_pure_builtin(std::string_view name, size_t nwords);
+
+// Run a single pipeline stage in-process if it names a builtin (or is a
+// `cat` that cat.h takes), applying its redirections around the call. `in` and `out`, if set,
+// stand in for stdin and stdout (a pipeline's pipes); the stage's own
+// redirections win over them. Returns false (and does nothing) if the
+// command isn't a builtin.
+bool run_builtin(const CmdSegment& seg, int& status, int in = -1, int out = -1);
+
+#endif // GOONSH_BUILTINS_H
@@ -0,0 +1,29 @@
+#ifndef GOONSH_CAT_H
+#define GOONSH_CAT_H
+
+#include <string>
+#include <vector>
+
+// `cat FILE...` without a process of its own. File data never passes
+// through the shell's memory: it goes out with copy_file_range(2) when
+// stdout is a regular file, splice(2) when it is a pipe and sendfile(2)
+// otherwise; read/write is only the fallback for what the kernel won't
+// move (a terminal, /proc files, appending). In a pipeline the stages
+// after it start first and it splices into their pipe as they read, so
+// `cat big.log | grep x` is one process and no copy in userspace.
+
+// Can this cat run in the shell? Only plain file operands (no options, no
+// "-" for stdin), and only in a shell without job control: an interactive
+// one keeps cat a process of its own that ^C and ^Z can reach.
+bool cat_in_process(const std::vector<std::string>& args);
+
+// The builtin: write every file in args[1..] to stdout, reporting the ones
+// that can't be read. Returns 0, 1 if some file failed, or 128 + SIGPIPE
+// (silently) if stdout's reader went away.
+int cat_run(const std::vector<std::string>& args);
+
+// Copy `in` to `out` from their current offsets to end of input, inside
+// the kernel where it can. Returns 0 or an errno.
+int cat_copy(int in, int out);
+
+#endif // GOONSH_CAT_H
@@ -0,0 +1,65 @@
+// dgsh-client: run commands in a `dgsh --serve` shell (see serve.h), as
+// `dgsh -c` would run them here, in our directory and with our stdin,
+// stdout and stderr. Kept apart from the shell so it starts in a fraction
+// of the time: no readline, no config, nothing but the socket.
+
+#include "servemsg.h"
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <unistd.h>
+
+int main(int argc, char* argv[]) {
+    const char* usage = "usage: dgsh-client SOCKET [-e NAME=VALUE]... COMMANDS [NAME [ARG...]]";
+    if (argc < 3) {
+        fprintf(stderr, "%s\n", usage);
+        return 2;
+    }
+    const char* path = argv[1];
+    ServeRequest req;
+    int i = 2;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        std::string_view opt = argv[i];
+        if (opt == "--") {
+            ++i;
+            break;
+        }
+        if (opt == "-e" && i + 1 < argc && strchr(argv[i + 1], '=')) {
+            req.env.push_back(argv[++i]);
+            continue;
+        }
+        fprintf(stderr, "dgsh-client: %s: invalid option\n%s\n", argv[i], usage);
+        return 2;
+    }
+    if (i == argc) {
+        fprintf(stderr, "%s\n", usage);
+        return 2;
+    }
+    req.command = argv[i++];
+    req.args.assign(argv + i, argv + argc);
+    // 125: the server couldn't be asked, as opposed to the command failing
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        fprintf(stderr, "dgsh-client: current directory: %s\n", strerror(errno));
+        return 125;
+    }
+    req.cwd = cwd;
+    int sock = serve_connect(path);
+    if (sock < 0) {
+        fprintf(stderr, "dgsh-client: %s: %s\n", path, strerror(errno));
+        return 125;
+    }
+    const int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    if (!serve_send(sock, req, fds)) {
+        fprintf(stderr, "dgsh-client: %s: %s\n", path, strerror(errno));
+        return 125;
+    }
+    int status = serve_wait(sock);
+    if (status < 0) {
+        fprintf(stderr, "dgsh-client: %s: server went away\n", path);
+        return 125;
+    }
+    return status;
+}
@@ -0,0 +1,248 @@
+#include "cmdhash.h"
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <dirent.h>
+#include <thread>
+#include <unistd.h>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <vector>
+
+struct PathDir {
+    std::string path;
+    struct timespec mtime = {0, 0};
+    bool scanned = false;
+    std::vector<std::string> names;
+};
+
+struct HashEntry {
+    size_t dir;   // index into path_dirs
+    int hits = 0;
+    bool checked = false;  // dir's file was found executable by a lookup
+};
+
+static std::string cached_path;
+static std::vector<PathDir> path_dirs;
+static std::unordered_map<std::string, HashEntry> table;
+static std::vector<std::string> sorted_names;
+// A scan started by cmdhash_prefetch(), for $PATH as it was then. Only
+// the process that started it joins it; a forked child leaves it alone
+// (its thread didn't come along) and scans for itself.
+struct Prefetch {
+    pid_t owner;
+    std::string path;
+    std::vector<PathDir> dirs;
+    std::thread thread;
+};
+static Prefetch* prefetch = nullptr;
+// cmdhash_lazy(): names resolved one at a time, for $PATH as it was then.
+struct LazyEntry {
+    std::string path;
+    int hits = 0;
+};
+static bool lazy = false;
+static std::string lazy_path;
+static std::unordered_map<std::string, LazyEntry> lazy_table;
+
+static void scan_dir(PathDir& pd) {
+    pd.names.clear();
+    pd.scanned = true;
+    DIR* d = opendir(pd.path.c_str());
+    if (!d) return;
+    struct dirent* entry;
+    while ((entry = readdir(d))) {
+        if (entry->d_type == DT_REG || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+            pd.names.push_back(entry->d_name);
+    }
+    closedir(d);
+}
+
+static void rebuild_table() {
+    // Keep hit counts across rebuilds so `hash` output stays meaningful.
+    std::unordered_map<std::string, HashEntry> old;
+    old.swap(table);
+    sorted_names.clear();
+    for (size_t i = 0; i < path_dirs.size(); ++i) {
+        for (const auto& name : path_dirs[i].names) {
+            // First directory in $PATH wins, like execvp.
+            auto res = table.emplace(name, HashEntry{i, 0});
+            if (!res.second) continue;
+            auto it = old.find(name);
+            if (it != old.end()) res.first->second.hits = it->second.hits;
+            sorted_names.push_back(name);
+        }
+    }
+    std::sort(sorted_names.begin(), sorted_names.end());
+}
+
+// The directories of `path`, taking over already scanned ones from `old`.
+static std::vector<PathDir> split_path(const std::string& path, std::vector<PathDir>& old) {
+    std::vector<PathDir> dirs;
+    std::istringstream iss(path);
+    std::string dir;
+    while (std::getline(iss, dir, ':')) {
+        if (dir.empty()) dir = ".";
+        auto it = std::find_if(old.begin(), old.end(), [&](const PathDir& pd) { return pd.path == dir; });
+        if (it != old.end()) {
+            dirs.push_back(std::move(*it));
+        } else {
+            PathDir pd;
+            pd.path = dir;
+            dirs.push_back(std::move(pd));
+        }
+    }
+    return dirs;
+}
+
+// One stat(), and a readdir if the directory's mtime moved. Returns
+// whether its names changed.
+static bool revalidate(PathDir& pd) {
+    struct stat st;
+    if (stat(pd.path.c_str(), &st) != 0) {
+        if (pd.names.empty() && pd.scanned) return false;
+        pd.names.clear();
+        pd.scanned = true;
+        return true;
+    }
+    if (pd.scanned && st.st_mtim.tv_sec == pd.mtime.tv_sec && st.st_mtim.tv_nsec == pd.mtime.tv_nsec)
+        return false;
+    pd.mtime = st.st_mtim;
+    scan_dir(pd);
+    return true;
+}
+
+// Re-validate the index: one stat() per $PATH directory, and a readdir only
+// for directories whose mtime moved.
+static void refresh() {
+    const char* env = getenv("PATH");
+    std::string path = env ? env : "";
+    bool changed = false;
+    if (prefetch && prefetch->owner == getpid()) {
+        prefetch->thread.join();
+        if (path_dirs.empty() && path == prefetch->path) {
+            path_dirs.swap(prefetch->dirs);
+            cached_path = path;
+            changed = true;
+        }
+        delete prefetch;
+        prefetch = nullptr;
+    }
+    if (path != cached_path || path_dirs.empty()) {
+        path_dirs = split_path(path, path_dirs);
+        cached_path = path;
+        changed = true;
+    }
+    for (auto& pd : path_dirs)
+        if (revalidate(pd)) changed = true;
+    if (changed) rebuild_table();
+}
+
+// What execvp would run: a regular file (through symlinks) we may execute.
+static bool is_executable(const std::string& file) {
+    struct stat st;
+    return stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(file.c_str(), X_OK) == 0;
+}
+
+// First executable `name` in a $PATH directory, like execvp, remembered
+// until $PATH changes.
+static std::string lazy_lookup(const std::string& name) {
+    const char* env = getenv("PATH");
+    std::string path = env ? env : "";
+    if (path != lazy_path) {
+        lazy_table.clear();
+        lazy_path = path;
+    }
+    auto it = lazy_table.find(name);
+    if (it == lazy_table.end()) {
+        std::istringstream iss(path);
+        std::string dir;
+        while (std::getline(iss, dir, ':')) {
+            std::string file = (dir.empty() ? "." : dir) + "/" + name;
+            if (is_executable(file)) {
+                it = lazy_table.emplace(name, LazyEntry{file}).first;
+                break;
+            }
+        }
+        if (it == lazy_table.end()) return "";
+    }
+    ++it->second.hits;
+    return it->second.path;
+}
+
+const std::vector<std::string>& cmdhash_commands() {
+    refresh();
+    return sorted_names;
+}
+
+std::string cmdhash_lookup(const std::string& name) {
+    if (name.empty() || name.find('/') != std::string::npos) return "";
+    if (lazy) return lazy_lookup(name);
+    refresh();
+    auto it = table.find(name);
+    if (it == table.end()) return "";
+    HashEntry& e = it->second;
+    if (!e.checked) {
+        // The scan only reads directories: the first lookup of a name makes
+        // sure it can run, and a non-executable file with that name early
+        // in $PATH gives way to the next one, as with execvp and lazy mode
+        size_t dir = e.dir;
+        while (dir < path_dirs.size() && !is_executable(path_dirs[dir].path + "/" + name)) {
+            for (++dir; dir < path_dirs.size(); ++dir) {
+                const auto& names = path_dirs[dir].names;
+                if (std::find(names.begin(), names.end(), name) != names.end()) break;
+            }
+        }
+        if (dir == path_dirs.size()) return "";
+        e.dir = dir;
+        e.checked = true;
+    }
+    ++e.hits;
+    return path_dirs[e.dir].path + "/" + name;
+}
+
+std::vector<std::pair<int, std::string>> cmdhash_remembered() {
+    std::vector<std::pair<int, std::string>> out;
+    if (lazy) {
+        std::vector<const std::pair<const std::string, LazyEntry>*> used;
+        for (const auto& entry : lazy_table) used.push_back(&entry);
+        std::sort(used.begin(), used.end(), [](auto* a, auto* b) { return a->first < b->first; });
+        for (auto* entry : used) out.emplace_back(entry->second.hits, entry->second.path);
+        return out;
+    }
+    for (const auto& name : sorted_names) {
+        const HashEntry& e = table[name];
+        if (e.hits > 0) out.emplace_back(e.hits, path_dirs[e.dir].path + "/" + name);
+    }
+    return out;
+}
+
+void cmdhash_reset() {
+    cached_path.clear();
+    path_dirs.clear();
+    table.clear();
+    sorted_names.clear();
+    lazy_table.clear();
+}
+
+void cmdhash_lazy() {
+    lazy = true;
+}
+
+void cmdhash_prefetch() {
+    if (prefetch || !path_dirs.empty()) return;
+    const char* env = getenv("PATH");
+    prefetch = new Prefetch{getpid(), env ? env : "", {}, {}};
+    // Signals stay with the main thread: the scan starts with them blocked
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    prefetch->thread = std::thread([p = prefetch] {
+        std::vector<PathDir> none;
+        p->dirs = split_path(p->path, none);
+        for (auto& pd : p->dirs) revalidate(pd);
+    });
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
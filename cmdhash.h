@@ -0,0 +1,31 @@
+#ifndef GOONSH_CMDHASH_H
+#define GOONSH_CMDHASH_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Persistent command hash (name -> resolved path), like bash's `hash`.
+// The index is only rebuilt when $PATH changes or one of its directories
+// gets a new mtime, so completion and exec don't rescan PATH every time.
+
+// Sorted, de-duplicated command names from every $PATH directory.
+const std::vector<std::string>& cmdhash_commands();
+// Resolved path for a command name, or "" if it isn't on $PATH.
+// Names containing a '/' are never looked up.
+std::string cmdhash_lookup(const std::string& name);
+// Commands that have been looked up so far, as (hits, path) pairs.
+std::vector<std::pair<int, std::string>> cmdhash_remembered();
+// Forget everything and rescan $PATH on next use (`hash -r`).
+void cmdhash_reset();
+// Look names up one at a time, as bash does, instead of indexing all of
+// $PATH: for shells that never complete a command name (scripts, -c,
+// piped input). A name costs up to one stat() per $PATH directory on its
+// first lookup and is then remembered until $PATH changes; the command
+// list above still scans.
+void cmdhash_lazy();
+// Start scanning $PATH on a background thread; the first use of the index
+// waits for it instead of scanning itself.
+void cmdhash_prefetch();
+
+#endif // GOONSH_CMDHASH_H
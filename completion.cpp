@@ -1,6 +1,12 @@
 #include <cstdio>
 #include "completion.h"
+#include "alias.h"
 #include "utils.h"
+#include "cmdhash.h"
+#include "fuzzy.h"
+#include "history.h"
+#include "parser.h"
+#include "shell.h"
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <string>
@@ -8,38 +14,29 @@
 #include <map>
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 
-extern std::vector<std::string> builtins;
-extern std::map<std::string, std::string> aliases;
 
 // Autosuggestion logic (explicit key binding, no redisplay handler)
 std::string find_history_suggestion(const char* input) {
-    HIST_ENTRY** hist = history_list();
-    if (!hist) return "";
-    std::string prefix = input ? input : "";
-    if (prefix.empty()) return "";
+    if (!input || !*input) return "";
     const size_t MAX_SUGGEST_LEN = 256;
-    for (int i = history_length - 1; i >= 0; --i) {
-        std::string h = hist[i]->line;
-        if (h.find(prefix) == 0 && h != prefix) {
-            // Only suggest if not excessively longer than input
-            if (h.length() - prefix.length() > MAX_SUGGEST_LEN) continue;
-            // Only suggest if not an exact repeat of the last command
-            if (i < history_length - 1 && h == hist[i+1]->line) continue;
-            return h.substr(prefix.size());
-        }
-    }
-    return "";
+    std::string_view prefix(input);
+    std::string_view h = history_find_prefix(prefix, MAX_SUGGEST_LEN);
+    if (h.empty()) return "";
+    return std::string(h.substr(prefix.size()));
 }
 
 std::string find_file_suggestion(const char* input) {
     std::string prefix = input ? input : "";
     if (prefix.empty()) return "";
     // Only suggest for the last word
-    size_t last_space = prefix.find_last_of(" ");
-    std::string last_word = (last_space == std::string::npos) ? prefix : prefix.substr(last_space + 1);
-    std::string before = (last_space == std::string::npos) ? "" : prefix.substr(0, last_space + 1);
-    std::vector<std::string> files = get_files(last_word);
+    size_t word_start = cursor_context(prefix, prefix.size()).word_start;
+    std::string last_word = prefix.substr(word_start);
+    std::string before = prefix.substr(0, word_start);
+    // Ghost text only ever shows one candidate; don't materialize a huge directory
+    const size_t MAX_GHOST_CANDIDATES = 64;
+    std::vector<std::string> files = get_files(last_word, MAX_GHOST_CANDIDATES);
     // If the last word is already a full match for a file, do not suggest further
     for (const auto& f : files) {
         if (f == last_word) return "";
@@ -52,6 +49,27 @@ std::string find_file_suggestion(const char* input) {
     return "";
 }
 
+bool completion_fuzzy = false;
+// Readline lists at most this many fuzzy matches, best first
+static const size_t MAX_FUZZY_MATCHES = 100;
+
+static std::vector<std::string> fuzzy_commands(const std::string& pattern) {
+    std::vector<std::string_view> names;
+    const auto& cmds = cmdhash_commands();
+    names.reserve(builtins.size() + aliases.size() + cmds.size());
+    for (const auto& b : builtins) names.push_back(b);
+    auto alias_list = aliases.sorted();
+    for (const Alias* a : alias_list) names.push_back(a->name);
+    for (const auto& c : cmds) names.push_back(c);
+    std::vector<std::string> matches;
+    for (const auto& m : fuzzy_rank(pattern, names, MAX_FUZZY_MATCHES)) {
+        // A builtin or alias shadowing a PATH command is listed once
+        std::string_view name = names[m.index];
+        if (std::find(matches.begin(), matches.end(), name) == matches.end()) matches.emplace_back(name);
+    }
+    return matches;
+}
+
 char* completion_generator(const char* text, int state) {
     static size_t list_index;
     static std::vector<std::string> matches;
@@ -60,10 +78,16 @@ char* completion_generator(const char* text, int state) {
         std::string prefix(text);
         // Command completion for first word
         rl_completion_append_character = ' ';
-        if (rl_point == 0 || (rl_line_buffer && std::string(rl_line_buffer).find(' ') == std::string::npos)) {
+        bool command_position = !rl_line_buffer || cursor_context(rl_line_buffer, rl_point).command_position;
+        if (completion_fuzzy && !prefix.empty()) {
+            matches = command_position ? fuzzy_commands(prefix) : get_files_fuzzy(prefix, MAX_FUZZY_MATCHES);
+        } else if (command_position) {
             for (const auto& b : builtins) if (b.find(prefix) == 0) matches.push_back(b);
-            for (const auto& a : aliases) if (a.first.find(prefix) == 0) matches.push_back(a.first);
-            for (const auto& c : get_path_commands()) if (c.find(prefix) == 0) matches.push_back(c);
+            for (const Alias* a : aliases.sorted()) if (a->name.find(prefix) == 0) matches.push_back(a->name);
+            const auto& cmds = cmdhash_commands();
+            for (auto it = std::lower_bound(cmds.begin(), cmds.end(), prefix);
+                 it != cmds.end() && it->compare(0, prefix.size(), prefix) == 0; ++it)
+                matches.push_back(*it);
         } else {
             // File completion
             for (const auto& f : get_files(prefix)) matches.push_back(f);
@@ -110,17 +134,9 @@ void goonsh_redisplay() {
         return;
     }
     std::string input = rl_line_buffer ? rl_line_buffer : "";
-    // Only show file suggestion if cursor is after a space (not in command position)
-    size_t first_space = input.find(' ');
-    // Only show file suggestion if:
-    // - There is at least one space
-    // - The cursor is after the first space
-    // - The last word is not empty
-    bool after_command = (
-        first_space != std::string::npos &&
-        rl_point > (int)first_space &&
-        input.substr(first_space + 1).find_first_not_of(' ') != std::string::npos
-    );
+    // Only show file suggestion for a non-empty argument word (not in command position)
+    CursorContext ctx = cursor_context(input, rl_point);
+    bool after_command = !ctx.command_position && ctx.word_start < (size_t)rl_point;
     std::string suggestion;
     if (after_command) {
         suggestion = find_file_suggestion(input.c_str());
@@ -144,10 +160,42 @@ void goonsh_redisplay() {
     last_suggestion = suggestion;
 }
 
+// Ranked fuzzy matches in readline's format. matches[0] is what replaces
+// the typed word: the match itself when there is only one, otherwise the
+// longest prefix they share if it extends the text, else the text as typed.
+static char** fuzzy_completion_matches(const char* text) {
+    std::vector<char*> found;
+    for (int state = 0; char* m = completion_generator(text, state); ++state) found.push_back(m);
+    if (found.empty()) return nullptr;
+    char** result = static_cast<char**>(malloc((found.size() + 2) * sizeof(char*)));
+    if (found.size() == 1) {
+        result[0] = found[0];
+        result[1] = nullptr;
+        return result;
+    }
+    std::string_view common = found[0];
+    for (char* m : found) {
+        size_t n = 0;
+        while (n < common.size() && common[n] == m[n]) ++n;
+        common = common.substr(0, n);
+    }
+    size_t typed = strlen(text);
+    if (common.size() > typed && common.compare(0, typed, text) == 0)
+        result[0] = strndup(common.data(), common.size());
+    else result[0] = strdup(text);
+    std::copy(found.begin(), found.end(), result + 1);
+    result[found.size() + 1] = nullptr;
+    // Keep the ranking when readline lists them
+    rl_sort_completion_matches = 0;
+    return result;
+}
+
 // Wrap the completion function to set/clear the flag
 char** goonsh_completion(const char* text, int /*start*/, int /*end*/) {
     goonsh_completion_active = true;
-    char** result = rl_completion_matches(text, completion_generator);
+    rl_sort_completion_matches = 1;
+    char** result = completion_fuzzy && *text ? fuzzy_completion_matches(text)
+                                              : rl_completion_matches(text, completion_generator);
     goonsh_completion_active = false;
     return result;
 }
@@ -3,6 +3,10 @@
 
 #include <readline/rltypedefs.h>
 
+// `completion=fuzzy` in ~/.dgshrc: Tab offers fzf-style ranked matches
+// instead of only the names that start with what was typed.
+extern bool completion_fuzzy;
+
 char* completion_generator(const char* text, int state);
 char** goonsh_completion(const char* text, int start, int end);
 void goonsh_redisplay();
@@ -1,14 +1,16 @@
 #include "config.h"
+#include "alias.h"
+#include "completion.h"
+#include "prompt.h"
 #include <fstream>
 #include <string>
 #include <vector>
-#include <map>
 #include <cstdlib>
 #include <algorithm>
 
 const std::string RC_FILE = std::string(getenv("HOME")) + "/.dgshrc";
 
-void load_config(std::map<std::string, std::string>& aliases, std::string& prompt, std::vector<std::string>& rc_commands) {
+void load_config(AliasTable& aliases, std::string& prompt, std::vector<std::string>& rc_commands) {
     std::ifstream file(RC_FILE);
     std::string line;
     while (std::getline(file, line)) {
@@ -19,10 +21,14 @@ void load_config(std::map<std::string, std::string>& aliases, std::string& promp
                 std::string v = line.substr(eq+1);
                 v.erase(std::remove(v.begin(), v.end(), '"'), v.end());
                 v.erase(std::remove(v.begin(), v.end(), '\''), v.end());
-                aliases[k] = v;
+                aliases.define(k, v);
             }
         } else if (line.rfind("prompt=", 0) == 0) {
             prompt = line.substr(7);
+        } else if (line.rfind("prompt_timeout=", 0) == 0) {
+            prompt_wait_ms = std::max(0, atoi(line.c_str() + 15));
+        } else if (line.rfind("completion=", 0) == 0) {
+            completion_fuzzy = line.substr(11) == "fuzzy";
         } else if (!line.empty() && line[0] != '#') {
             rc_commands.push_back(line);
         }
@@ -3,8 +3,9 @@
 
 #include <string>
 #include <vector>
-#include <map>
 
-void load_config(std::map<std::string, std::string>& aliases, std::string& prompt, std::vector<std::string>& rc_commands);
+class AliasTable;
+
+void load_config(AliasTable& aliases, std::string& prompt, std::vector<std::string>& rc_commands);
 
 #endif // GOONSH_CONFIG_H
@@ -0,0 +1,87 @@
+#include "dircache.h"
+#include <algorithm>
+#include <dirent.h>
+#include <map>
+#include <string>
+#include <sys/stat.h>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct CachedDir {
+    struct timespec mtime;
+    DirListing entries;
+    unsigned long last_used;
+};
+
+// Keyed by device/inode rather than the path string so a relative "."
+// can't serve a stale listing after `cd`.
+std::map<std::pair<dev_t, ino_t>, CachedDir> cache;
+unsigned long use_clock = 0;
+const size_t MAX_DIRS = 32;
+const DirListing empty_listing;
+
+void read_listing(const std::string& dir, DirListing& out) {
+    out.clear();
+    DIR* d = opendir(dir.c_str());
+    if (!d) return;
+    struct dirent* entry;
+    while ((entry = readdir(d))) {
+        const char* name = entry->d_name;
+        bool is_dir = entry->d_type == DT_DIR;
+        // d_type can't see through symlinks, and some filesystems don't
+        // fill it in; only those entries pay for a stat().
+        if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            std::string fullpath = dir + "/" + name;
+            is_dir = stat(fullpath.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        out.push_back({name, is_dir});
+    }
+    closedir(d);
+    std::sort(out.begin(), out.end(),
+              [](const DirEntry& a, const DirEntry& b) { return a.name < b.name; });
+}
+
+void evict_oldest() {
+    auto oldest = cache.begin();
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->second.last_used < oldest->second.last_used) oldest = it;
+    }
+    cache.erase(oldest);
+}
+
+} // namespace
+
+const DirListing& dircache_list(const std::string& dir) {
+    struct stat st;
+    if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return empty_listing;
+    auto key = std::make_pair(st.st_dev, st.st_ino);
+    auto it = cache.find(key);
+    if (it == cache.end()) {
+        if (cache.size() >= MAX_DIRS) evict_oldest();
+        it = cache.emplace(key, CachedDir{st.st_mtim, {}, 0}).first;
+        read_listing(dir, it->second.entries);
+    } else if (it->second.mtime.tv_sec != st.st_mtim.tv_sec ||
+               it->second.mtime.tv_nsec != st.st_mtim.tv_nsec) {
+        it->second.mtime = st.st_mtim;
+        read_listing(dir, it->second.entries);
+    }
+    it->second.last_used = ++use_clock;
+    return it->second.entries;
+}
+
+std::pair<DirListing::const_iterator, DirListing::const_iterator>
+dircache_prefix(const DirListing& listing, std::string_view prefix) {
+    auto lo = std::partition_point(listing.begin(), listing.end(),
+                                   [&](const DirEntry& e) { return std::string_view(e.name) < prefix; });
+    auto hi = std::partition_point(lo, listing.end(), [&](const DirEntry& e) {
+        return std::string_view(e.name).substr(0, prefix.size()) == prefix;
+    });
+    return {lo, hi};
+}
+
+void dircache_clear() {
+    cache.clear();
+}
@@ -0,0 +1,28 @@
+#ifndef GOONSH_DIRCACHE_H
+#define GOONSH_DIRCACHE_H
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Per-directory listing cache for completion and ghost suggestions.
+// Listings are read once, stored sorted by name, and reused until the
+// directory's mtime changes.
+
+struct DirEntry {
+    std::string name;
+    bool is_dir;
+};
+
+using DirListing = std::vector<DirEntry>;
+
+// Cached, sorted listing of `dir` (empty if it can't be opened). The
+// reference stays valid until the next dircache_* call.
+const DirListing& dircache_list(const std::string& dir);
+// Entries of `listing` whose name starts with `prefix`, by binary search.
+std::pair<DirListing::const_iterator, DirListing::const_iterator>
+dircache_prefix(const DirListing& listing, std::string_view prefix);
+void dircache_clear();
+
+#endif // GOONSH_DIRCACHE_H
@@ -0,0 +1,687 @@
+#include "exec.h"
+#include "builtins.h"
+#include "cat.h"
+#include "cmdhash.h"
+#include "jobs.h"
+#include "shell.h"
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <optional>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+extern char** environ;
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+#define HAVE_SPAWN_TCSETPGRP 1
+#else
+#define HAVE_SPAWN_TCSETPGRP 0
+#endif
+
+bool exec_use_spawn = true;
+bool exec_job_groups = true;
+
+void close_heredocs(CmdSegment& seg) {
+    for (auto& r : seg.redirs) {
+        if (r.file == -1) continue;
+        close(r.file);
+        r.file = -1;
+    }
+}
+
+namespace {
+
+// Where one stage reads and writes; -1 means inherit the shell's fd.
+struct StageFds {
+    int in = -1;
+    int out = -1;
+    int err = -1;
+};
+
+// Move a descriptor the shell opened for a stage above 9, out of the way
+// of the N in N> and N<&M, which a stage applies after it is opened.
+int above_user_fds(int fd) {
+    if (fd < 0 || fd > 9) return fd;
+    int moved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    close(fd);
+    return moved;
+}
+
+// Anonymous file for a heredoc body; an unlinked temp file if memfd is missing.
+int heredoc_file() {
+    int fd = memfd_create("dgsh-heredoc", MFD_CLOEXEC);
+    if (fd < 0) fd = open(P_tmpdir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    return above_user_fds(fd);
+}
+
+bool write_line(int fd, const std::string& line) {
+    char newline = '\n';
+    struct iovec iov[2] = {{const_cast<char*>(line.data()), line.size()}, {&newline, 1}};
+    size_t want = line.size() + 1;
+    ssize_t n = writev(fd, iov, 2);
+    if (n == static_cast<ssize_t>(want)) return true;
+    // Short write: finish the rest the slow way
+    std::string rest = line + '\n';
+    for (size_t done = n > 0 ? n : 0; done < want; done += n) {
+        n = write(fd, rest.data() + done, want - done);
+        if (n <= 0) return false;
+    }
+    return true;
+}
+
+bool write_all(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t n = write(fd, data.data(), data.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data.remove_prefix(n);
+    }
+    return true;
+}
+
+void close_heredocs(std::vector<CmdSegment>& segments) {
+    for (auto& seg : segments) ::close_heredocs(seg);
+}
+
+int open_redir(const std::string& path, int flags) {
+    int fd = open(path.c_str(), flags | O_CLOEXEC, 0666);
+    if (fd < 0) std::cerr << "dgsh: " << path << ": " << strerror(errno) << std::endl;
+    return above_user_fds(fd);
+}
+
+// Descriptor number written after <& or >&, or -1 if it isn't one.
+int fd_number(const std::string& s) {
+    if (s.empty() || s.size() > 4 || s.find_first_not_of("0123456789") != std::string::npos) return -1;
+    return std::stoi(s);
+}
+
+// Is `fd` open once the stage's `actions` so far have run?
+bool fd_is_open(int fd, const std::vector<FdAction>& actions) {
+    for (auto it = actions.rbegin(); it != actions.rend(); ++it) {
+        if (it->to == fd) return it->from != -1;
+    }
+    return fcntl(fd, F_GETFD) != -1;
+}
+
+std::vector<char*> make_argv(std::vector<std::string>& args) {
+    std::vector<char*> argv;
+    argv.reserve(args.size() + 1);
+    for (auto& a : args) argv.push_back(&a[0]);
+    argv.push_back(nullptr);
+    return argv;
+}
+
+pid_t spawn_stage(std::vector<char*>& argv, const std::string& resolved, const StageFds& fds,
+                  const std::vector<FdAction>& redirs, pid_t pgid, bool take_terminal, int& err) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+#if HAVE_SPAWN_TCSETPGRP
+    // Before the dup2s: stdin may be about to become a pipe or heredoc
+    if (take_terminal) posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#else
+    (void)take_terminal;
+#endif
+    // Every fd the shell opens is O_CLOEXEC, so dup2 is all a stage needs.
+    if (fds.in != -1) posix_spawn_file_actions_adddup2(&actions, fds.in, STDIN_FILENO);
+    if (fds.out != -1) posix_spawn_file_actions_adddup2(&actions, fds.out, STDOUT_FILENO);
+    if (fds.err != -1) posix_spawn_file_actions_adddup2(&actions, fds.err, STDERR_FILENO);
+    // Then the stage's own redirections, which win over its pipes
+    for (const FdAction& a : redirs) {
+        if (a.from == -1) posix_spawn_file_actions_addclose(&actions, a.to);
+        else posix_spawn_file_actions_adddup2(&actions, a.from, a.to);
+    }
+
+    sigset_t defaults, mask;
+    sigemptyset(&defaults);
+    for (int sig : {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE, SIGWINCH})
+        sigaddset(&defaults, sig);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid = -1;
+    err = resolved.empty() ? ENOENT : posix_spawn(&pid, resolved.c_str(), &actions, &attr, argv.data(), environ);
+    // Hash miss or stale entry (gone, or no longer executable): let
+    // posix_spawnp search PATH itself
+    if (err == ENOENT || err == ENOTDIR || err == EACCES)
+        err = posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return err ? -1 : pid;
+}
+
+// dup2() and close() the way spawn file actions do: dup2 onto itself
+// keeps the descriptor across exec.
+void apply_fd_actions(const std::vector<FdAction>& redirs) {
+    for (const FdAction& a : redirs) {
+        if (a.from == -1) close(a.to);
+        else if (a.from == a.to) fcntl(a.to, F_SETFD, 0);
+        else dup2(a.from, a.to);
+    }
+}
+
+// In a forked stage: join the job, take default signals and its fds.
+void enter_stage(const StageFds& fds, const std::vector<FdAction>& redirs, pid_t pgid, bool take_terminal) {
+    setpgid(0, pgid);
+    if (take_terminal) tcsetpgrp(STDIN_FILENO, getpgrp());
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGWINCH, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, nullptr);
+    if (fds.in != -1) dup2(fds.in, STDIN_FILENO);
+    if (fds.out != -1) dup2(fds.out, STDOUT_FILENO);
+    if (fds.err != -1) dup2(fds.err, STDERR_FILENO);
+    apply_fd_actions(redirs);
+}
+
+pid_t fork_stage(std::vector<char*>& argv, const std::string& resolved, const StageFds& fds,
+                 const std::vector<FdAction>& redirs, pid_t pgid, bool take_terminal, int& err) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        enter_stage(fds, redirs, pgid, take_terminal);
+        if (!resolved.empty()) execv(resolved.c_str(), argv.data());
+        execvp(argv[0], argv.data());
+        std::cerr << "dgsh: " << argv[0] << ": " << (errno == ENOENT ? "command not found" : strerror(errno))
+                  << std::endl;
+        _exit(errno == ENOENT ? 127 : 126);
+    }
+    err = pid < 0 ? errno : 0;
+    return pid;
+}
+
+// A builtin that changes shell state (cd, exit, export...) runs in a
+// forked copy of the shell when it is one stage of a pipeline, as in
+// other shells: the change stays in that copy.
+pid_t fork_builtin_stage(const CmdSegment& seg, const StageFds& fds, const std::vector<FdAction>& redirs,
+                         pid_t pgid, bool take_terminal, int& err) {
+    // Anything still buffered would be written twice
+    std::cout.flush();
+    std::cerr.flush();
+    fflush(nullptr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        enter_stage(fds, redirs, pgid, take_terminal);
+        jobs_forget();
+        int status = find_builtin(seg.args[0])(seg.args);
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(nullptr);
+        _exit(status);
+    }
+    err = pid < 0 ? errno : 0;
+    return pid;
+}
+
+// Command text shown by `jobs` for stages [first, last).
+std::string describe(const std::vector<CmdSegment>& segments, size_t first, size_t last) {
+    std::string text;
+    for (size_t s = first; s < last; ++s) {
+        const CmdSegment& seg = segments[s];
+        if (!text.empty()) text += " | ";
+        for (size_t i = 0; i < seg.args.size(); ++i) text += (i ? " " : "") + seg.args[i];
+    }
+    return text;
+}
+
+void print_time(const char* label, const struct timeval& tv) {
+    long ms = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    fprintf(stderr, "%s\t%ldm%ld.%03lds\n", label, ms / 60000, ms / 1000 % 60, ms % 1000);
+}
+
+// `time PIPELINE`: wall clock, CPU time of the shell plus every stage (from
+// wait4), and the largest max RSS among them, like bash's `time` keyword.
+int time_pipeline(std::vector<CmdSegment>& segments) {
+    struct rusage self_before, self_after, children = {};
+    getrusage(RUSAGE_SELF, &self_before);
+    auto start = std::chrono::steady_clock::now();
+    int status = 0;
+    bool lone_builtin = segments.size() == 1 && !segments[0].background;
+    if (segments.size() == 1 && segments[0].args.empty() && segments[0].redirs.empty()) {
+        // bare `time` times nothing
+    } else if (lone_builtin && run_builtin(segments[0], status)) {
+        close_heredocs(segments);
+    } else {
+        lone_builtin = false;
+        status = run_pipeline(segments, &children);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    getrusage(RUSAGE_SELF, &self_after);
+
+    struct timeval real = {static_cast<time_t>(elapsed.count() / 1000000),
+                           static_cast<suseconds_t>(elapsed.count() % 1000000)};
+    struct timeval user, sys;
+    timersub(&self_after.ru_utime, &self_before.ru_utime, &user);
+    timersub(&self_after.ru_stime, &self_before.ru_stime, &sys);
+    timeradd(&user, &children.ru_utime, &user);
+    timeradd(&sys, &children.ru_stime, &sys);
+    long maxrss = lone_builtin ? self_after.ru_maxrss : children.ru_maxrss;
+    std::cout.flush();
+    fprintf(stderr, "\n");
+    print_time("real", real);
+    print_time("user", user);
+    print_time("sys", sys);
+    fprintf(stderr, "maxrss\t%ldk\n", maxrss);
+    return status;
+}
+
+// A started pipeline: its job (nullptr if no stage started, or the last
+// stage was a builtin) and the exit status of a last stage that never
+// started or ran in the shell. `earlier` holds the jobs that fed builtin
+// stages, still to be waited for after `job`.
+struct Launch {
+    Job* job = nullptr;
+    bool job_control = false;
+    int last_failed = 0;
+    std::vector<Job*> earlier;
+    // What a builtin last stage wrote when io.out was set, for the caller
+    // to pass on once it is reading (see launch_stages)
+    int output = -1;
+};
+
+// Does stage `i` run in the shell? A builtin does if it leaves the
+// shell's state alone (the others get a fork, see fork_builtin_stage); a
+// cat (see cat.h) only where the shell can't end up stuck in it: not in
+// the background, and not writing into a pipe the shell itself reads.
+bool in_shell_stage(const std::vector<CmdSegment>& segments, size_t i, const StageFds& io) {
+    const CmdSegment& seg = segments[i];
+    if (seg.args.empty()) return false;
+    if (find_builtin(seg.args[0])) return is_pure_builtin(seg.args[0], seg.args.size());
+    return io.out == -1 && !segments.back().background && cat_in_process(seg.args);
+}
+
+// Spawn stages [first, last) of a pipeline and register them as one job.
+// Set fds in `io` replace the shell's: stdin of the first stage, stdout of
+// the last and stderr of all of them (the stages' own redirections still
+// win).
+Launch launch_pipeline(std::vector<CmdSegment>& segments, size_t first, size_t last, const StageFds& io,
+                       bool background) {
+    Launch result;
+    size_t n = last;
+    int shell_terminal = STDIN_FILENO;
+    // Only a shell in the foreground of its terminal can hand it over (not
+    // one run in the background, or serving a client's terminal)
+    bool job_control = !background && isatty(shell_terminal) && tcgetpgrp(shell_terminal) == getpgrp();
+    bool spawn = exec_use_spawn && (!job_control || HAVE_SPAWN_TCSETPGRP);
+
+    std::vector<pid_t> pids;
+    pid_t pgid = exec_job_groups ? 0 : getpgrp();
+    pid_t last_pid = -1;
+    int last_failed = 0;  // exit status of a last stage that never started
+    int prev_fd = -1;
+    // Nothing is reaped until the job is registered: a group leader that
+    // exits early must stay a zombie or later stages can't join its group.
+    std::optional<ChildSignalBlock> hold(std::in_place);
+    std::optional<TraceSpan> launch(std::in_place, "spawn");
+
+    for (size_t i = first; i < n; ++i) {
+        CmdSegment& seg = segments[i];
+        StageFds fds;
+        std::vector<FdAction> redirs;
+        std::vector<int> to_close;
+        int pipefd[2] = {-1, -1};
+        if (i + 1 < n && pipe2(pipefd, O_CLOEXEC) != 0) {
+            perror("pipe");
+            break;
+        }
+        fds.in = i > first ? prev_fd : io.in;
+        fds.out = i + 1 < n ? pipefd[1] : io.out;
+        fds.err = io.err;
+        bool ok = seg.redirs.empty() || stage_redirections(seg, redirs, to_close);
+
+        pid_t pid = -1;
+        int err = 0;
+        if (ok && !seg.args.empty() && find_builtin(seg.args[0])) {
+            bool take_terminal = job_control && pgid == 0;
+            pid = fork_builtin_stage(seg, fds, redirs, pgid, take_terminal, err);
+            if (pid < 0) {
+                if (take_terminal) tcsetpgrp(shell_terminal, getpgrp());
+                std::cerr << "dgsh: fork: " << strerror(err) << std::endl;
+            }
+        } else if (ok && !seg.args.empty()) {
+            // Resolve through the command hash so the index stays warm
+            std::string resolved = cmdhash_lookup(seg.args[0]);
+            auto argv = make_argv(seg.args);
+            bool take_terminal = job_control && pgid == 0;
+            pid = spawn ? spawn_stage(argv, resolved, fds, redirs, pgid, take_terminal, err)
+                        : fork_stage(argv, resolved, fds, redirs, pgid, take_terminal, err);
+            if (pid < 0) {
+                // A failed spawn may already have handed the terminal to its
+                // process group, which is now gone
+                if (take_terminal) tcsetpgrp(shell_terminal, getpgrp());
+                if (err == ENOENT) std::cerr << "dgsh: " << seg.args[0] << ": command not found" << std::endl;
+                else std::cerr << "dgsh: " << seg.args[0] << ": " << strerror(err) << std::endl;
+            }
+        }
+
+        for (int fd : to_close) close(fd);
+        if (prev_fd != -1) close(prev_fd);
+        if (pipefd[1] != -1) close(pipefd[1]);
+        prev_fd = pipefd[0];
+
+        if (pid > 0) {
+            // Also set from the parent so neither side races the other
+            setpgid(pid, pgid ? pgid : pid);
+            if (!pgid) {
+                pgid = pid;
+                if (job_control) tcsetpgrp(shell_terminal, pgid);
+            }
+            pids.push_back(pid);
+        }
+        if (i + 1 == n) {
+            last_pid = pid;
+            if (!ok) last_failed = 1;
+            else if (pid < 0 && !seg.args.empty()) last_failed = err == ENOENT ? 127 : 126;
+        }
+    }
+    if (prev_fd != -1) close(prev_fd);
+    launch.reset();
+
+    result.job_control = job_control;
+    result.last_failed = last_failed;
+    if (!pids.empty())
+        result.job =
+            job_add(pgid, pids, describe(segments, first, last), background, last_pid < 0 ? last_failed : 0);
+    return result;
+}
+
+// Launch a pipeline whose stages may be builtins. Those run in the shell
+// as their turn comes: the stages before one are launched as a job
+// writing into a pipe that the builtin gets as stdin, and the builtin
+// writes into an anonymous file that the stages after it read, so no
+// builtin ever waits on a stage that hasn't started. A builtin last stage
+// writes straight to the shell's stdout, but into another such file when
+// `io` sets one: that is a pipe the caller only reads after we return,
+// which a big enough output would fill. A cat followed only by
+// processes is the exception: they start first and it streams into their
+// pipe.
+Launch launch_stages(std::vector<CmdSegment>& segments, const StageFds& io) {
+    bool background = segments.back().background;
+    size_t n = segments.size();
+    size_t begin = 0;
+    int in = io.in;
+    int owned_in = -1;  // the previous builtin's output, ours to close
+    std::vector<Job*> earlier;
+    bool job_control = false;
+    auto finish = [&](int status, int output = -1) {
+        if (owned_in != -1) close(owned_in);
+        Launch result;
+        result.output = output;
+        result.job_control = job_control;
+        result.last_failed = status;
+        result.earlier = std::move(earlier);
+        return result;
+    };
+    for (size_t i = 0; i < n; ++i) {
+        if (!in_shell_stage(segments, i, io)) continue;
+        int pipefd[2] = {-1, -1};
+        int builtin_in = in;
+        if (begin < i) {
+            if (pipe2(pipefd, O_CLOEXEC) != 0) {
+                perror("pipe");
+                return finish(1);
+            }
+            StageFds feed = io;
+            feed.in = in;
+            feed.out = pipefd[1];
+            Launch part = launch_pipeline(segments, begin, i, feed, background);
+            close(pipefd[1]);
+            if (part.job) earlier.push_back(part.job);
+            job_control = part.job_control;
+            builtin_in = pipefd[0];
+        }
+        bool stream = i + 1 < n && !find_builtin(segments[i].args[0]);
+        for (size_t j = i + 1; stream && j < n; ++j) stream = !in_shell_stage(segments, j, io);
+        if (stream) {
+            int streamfd[2];
+            if (pipe2(streamfd, O_CLOEXEC) != 0) {
+                perror("pipe");
+                if (pipefd[0] != -1) close(pipefd[0]);
+                return finish(1);
+            }
+            StageFds rest = io;
+            rest.in = streamfd[0];
+            Launch result = launch_pipeline(segments, i + 1, n, rest, background);
+            close(streamfd[0]);
+            int status = 0;
+            run_builtin(segments[i], status, builtin_in, streamfd[1]);
+            close(streamfd[1]);
+            if (pipefd[0] != -1) close(pipefd[0]);
+            if (owned_in != -1) close(owned_in);
+            if (!result.job) result.job_control = job_control;
+            result.earlier = std::move(earlier);
+            return result;
+        }
+        int out = io.out;
+        if (i + 1 < n || io.out != -1) {
+            out = heredoc_file();
+            if (out < 0) {
+                perror("pipeline");
+                if (pipefd[0] != -1) close(pipefd[0]);
+                return finish(1);
+            }
+        }
+        int status = 0;
+        run_builtin(segments[i], status, builtin_in, out);
+        if (pipefd[0] != -1) close(pipefd[0]);
+        if (out != io.out) lseek(out, 0, SEEK_SET);
+        if (i + 1 == n) return finish(status, out != io.out ? out : -1);
+        if (owned_in != -1) close(owned_in);
+        in = owned_in = out;
+        begin = i + 1;
+    }
+    StageFds rest = io;
+    rest.in = in;
+    Launch result = launch_pipeline(segments, begin, n, rest, background);
+    if (owned_in != -1) close(owned_in);
+    if (!result.job) result.job_control = job_control;
+    result.earlier = std::move(earlier);
+    return result;
+}
+
+// Wait for a launched pipeline and the jobs that fed its builtin stages.
+int wait_launch(Launch& launch, struct rusage* usage = nullptr) {
+    int status = launch.job ? job_wait(launch.job, launch.job_control, usage) : launch.last_failed;
+    for (Job* job : launch.earlier) job_wait(job, launch.job_control);
+    return status;
+}
+
+} // namespace
+
+int run_pipeline(std::vector<CmdSegment>& segments, struct rusage* usage) {
+    if (usage) *usage = {};
+    Launch launch = launch_stages(segments, StageFds());
+    int status = launch.last_failed;
+    if (!segments.back().background) {
+        status = wait_launch(launch, usage);
+    } else if (launch.job) {
+        if (isatty(STDIN_FILENO)) std::cout << "[" << launch.job->id << "] " << launch.job->pgid << std::endl;
+        status = 0;
+    }
+    close_heredocs(segments);
+    return status;
+}
+
+int capture_pipeline(std::vector<CmdSegment>& segments, std::string& out) {
+    segments.back().background = false;
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) != 0) {
+        perror("pipe");
+        close_heredocs(segments);
+        return 1;
+    }
+    StageFds io;
+    io.out = pipefd[1];
+    Launch launch = launch_stages(segments, io);
+    close(pipefd[1]);
+    read_all(pipefd[0], out);
+    close(pipefd[0]);
+    if (launch.output != -1) {
+        read_all(launch.output, out);
+        close(launch.output);
+    }
+    int status = wait_launch(launch);
+    close_heredocs(segments);
+    return status;
+}
+
+int execute(std::vector<CmdSegment>& segments, bool timed) {
+    if (timed) return time_pipeline(segments);
+    int status = 0;
+    if (segments.size() == 1 && !segments[0].background && run_builtin(segments[0], status)) {
+        close_heredocs(segments);
+        return status;
+    }
+    return run_pipeline(segments);
+}
+
+bool stage_redirections(const CmdSegment& seg, std::vector<FdAction>& actions, std::vector<int>& opened) {
+    for (const FdRedir& r : seg.redirs) {
+        switch (r.kind) {
+        case RedirKind::Heredoc:
+        case RedirKind::HereString:
+            if (r.file != -1) actions.push_back({r.fd, r.file});
+            break;
+        case RedirKind::DupIn:
+        case RedirKind::DupOut: {
+            if (r.target == "-") {
+                actions.push_back({r.fd, -1});
+                break;
+            }
+            int from = fd_number(r.target);
+            if (from < 0) {
+                std::cerr << "dgsh: " << r.target << ": ambiguous redirect" << std::endl;
+                return false;
+            }
+            if (!fd_is_open(from, actions)) {
+                std::cerr << "dgsh: " << from << ": " << strerror(EBADF) << std::endl;
+                return false;
+            }
+            actions.push_back({r.fd, from});
+            break;
+        }
+        default: {
+            int flags = O_WRONLY | O_CREAT | O_TRUNC;
+            if (r.kind == RedirKind::In) flags = O_RDONLY;
+            else if (r.kind == RedirKind::Append || r.kind == RedirKind::AppendErr) flags = O_WRONLY | O_CREAT | O_APPEND;
+            int fd = open_redir(r.target, flags);
+            if (fd < 0) return false;
+            opened.push_back(fd);
+            actions.push_back({r.fd, fd});
+            if (r.kind == RedirKind::OutErr || r.kind == RedirKind::AppendErr) actions.push_back({STDERR_FILENO, r.fd});
+        }
+        }
+    }
+    return true;
+}
+
+int exec_stage(CmdSegment& seg) {
+    std::vector<FdAction> redirs;
+    std::vector<int> to_close;
+    bool ok = stage_redirections(seg, redirs, to_close);
+    if (ok) {
+        std::cout.flush();
+        fflush(nullptr);
+        for (int sig : {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE, SIGWINCH})
+            signal(sig, SIG_DFL);
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, nullptr);
+        apply_fd_actions(redirs);
+        auto argv = make_argv(seg.args);
+        // execvp looks the one name up itself: no PATH index to build
+        execvp(argv[0], argv.data());
+        int err = errno;
+        std::cerr << "dgsh: " << seg.args[0] << ": " << (err == ENOENT ? "command not found" : strerror(err))
+                  << std::endl;
+        return err == ENOENT ? 127 : 126;
+    }
+    for (int fd : to_close) close(fd);
+    close_heredocs(seg);
+    return 1;
+}
+
+Job* start_pipeline(std::vector<CmdSegment>& segments, int in, int out, int err, int& status) {
+    segments.back().background = true;
+    StageFds io;
+    io.in = in;
+    io.out = out;
+    io.err = err;
+    Launch launch = launch_pipeline(segments, 0, segments.size(), io, true);
+    close_heredocs(segments);
+    status = launch.last_failed;
+    return launch.job;
+}
+
+void read_all(int fd, std::string& out) {
+    // Straight into the buffer's spare capacity, growing it a block at a time
+    const size_t BLOCK = 64 * 1024;
+    for (;;) {
+        size_t used = out.size();
+        if (out.capacity() - used < BLOCK) out.reserve(std::max(out.capacity() * 2, used + BLOCK));
+        out.resize(out.capacity());
+        ssize_t n = read(fd, &out[used], out.size() - used);
+        out.resize(used + (n > 0 ? n : 0));
+        if (n == 0 || (n < 0 && errno != EINTR)) break;
+    }
+}
+
+bool collect_heredocs(std::vector<CmdSegment>& segments, const std::function<bool(std::string&)>& next_line) {
+    TraceSpan span("heredoc");
+    std::string line;
+    for (auto& seg : segments) {
+        for (auto& r : seg.redirs) {
+            if (r.kind != RedirKind::Heredoc && r.kind != RedirKind::HereString) continue;
+            int fd = r.file = heredoc_file();
+            bool ok = fd >= 0;
+            if (!ok) {
+                perror("heredoc");
+            } else if (r.kind == RedirKind::HereString) {
+                ok = write_line(fd, r.target);
+                if (!ok) perror("heredoc");
+            } else if (r.body.data()) {
+                // Scripts carry the body in their source: one write, no line splitting
+                ok = write_all(fd, r.body);
+                if (!ok) perror("heredoc");
+            } else {
+                while ((ok = next_line(line)) && line != r.target) {
+                    if (!write_line(fd, line)) {
+                        perror("heredoc");
+                        ok = false;
+                        break;
+                    }
+                }
+            }
+            if (!ok) {
+                close_heredocs(segments);
+                return false;
+            }
+            lseek(fd, 0, SEEK_SET);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,77 @@
+#ifndef GOONSH_EXEC_H
+#define GOONSH_EXEC_H
+
+#include <functional>
+#include <sys/resource.h>
+#include <string>
+#include <vector>
+#include "parser.h"
+
+struct Job;
+
+// Process launch. Pipeline stages are started with posix_spawn, which
+// glibc implements with clone(CLONE_VM|CLONE_VFORK): nothing is copied
+// from the parent however large its heap gets. Pipes and redirections are
+// handed over as spawn file actions and the process group is set through
+// spawn attributes. fork() is only used when the foreground terminal
+// can't be handed over at spawn time (glibc < 2.35).
+
+// Launch a pipeline as a new job and wait for it, unless it runs in the
+// background (see jobs.h). `usage` gets the resource usage of its stages.
+// Builtin stages that only read shell state run in the shell process, in
+// turn, with their output handed to the next stage through an anonymous
+// file; the others (cd, exit, export...) run in a fork, like a subshell.
+int run_pipeline(std::vector<CmdSegment>& segments, struct rusage* usage = nullptr);
+// Run a pipeline in the foreground with the last stage's stdout going into
+// a pipe, appending everything it writes to `out` (whose capacity is
+// reused); returns its exit status.
+int capture_pipeline(std::vector<CmdSegment>& segments, std::string& out);
+// Start a pipeline without waiting for it, as a job that leaves the
+// terminal to the shell. `in`, `out` and `err` replace the shell's stdin,
+// stdout and stderr for its stages (-1 keeps them). Returns nullptr, with
+// `status` set, if no stage could start; the caller waits for the job.
+// Every stage is a process of its own, builtins included (forked).
+Job* start_pipeline(std::vector<CmdSegment>& segments, int in, int out, int err, int& status);
+// Append everything readable from `fd` until end of file to `out`.
+void read_all(int fd, std::string& out);
+// Run a parsed line: a lone builtin stays in the shell process, anything
+// else (pipelines, background jobs, external commands) is spawned. With
+// `timed` (Pipeline::timed) it reports wall/user/sys time and max RSS on
+// stderr.
+int execute(std::vector<CmdSegment>& segments, bool timed = false);
+
+// Replace the shell with the external command `seg` (heredoc collected),
+// with its redirections and default signal dispositions: the tail call of
+// `dgsh -c`. Returns only if that failed, with the status to exit with.
+int exec_stage(CmdSegment& seg);
+
+// Read the body of every << in `segments`, one line per next_line() call
+// (which returns false at end of input), into an anonymous memfd that the
+// stage gets on the redirected fd; bodies already in the script source and
+// <<< strings are copied in with one write. Bodies of any size are written once and never sit in a
+// pipe buffer. Returns false if input ended before a delimiter.
+bool collect_heredocs(std::vector<CmdSegment>& segments, const std::function<bool(std::string&)>& next_line);
+
+// Close the heredoc and here-string bodies collect_heredocs opened.
+void close_heredocs(CmdSegment& seg);
+
+// One descriptor step of a stage's redirections: dup2(from, to), or
+// close(to) if `from` is -1.
+struct FdAction {
+    int to;
+    int from;
+};
+// Open the files `seg` redirects to (O_CLOEXEC, above fd 9 so no N> can
+// land on them) into `opened`, and append its redirections to `actions`
+// in order. Returns false, with a message, if a file can't be opened or a
+// <& or >& target isn't a descriptor.
+bool stage_redirections(const CmdSegment& seg, std::vector<FdAction>& actions, std::vector<int>& opened);
+
+// Set to false to force the fork() backend (benchmarks, debugging).
+extern bool exec_use_spawn;
+// Set to false to keep every job in the shell's own process group rather
+// than one per job, so that signalling the shell's group reaches all it
+// started (a --serve request being hung up on).
+extern bool exec_job_groups;
+
+#endif // GOONSH_EXEC_H
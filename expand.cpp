@@ -0,0 +1,338 @@
+#include "expand.h"
+#include "shell.h"
+#include "subst.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+namespace {
+
+bool is_name_start(char c) {
+    return isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+bool is_name_char(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+void append_number(long value, std::string& out) {
+    char buf[24];
+    int len = snprintf(buf, sizeof(buf), "%ld", value);
+    out.append(buf, len);
+}
+
+// Index of the '}' closing a "${" whose body starts at `from`, or npos.
+size_t find_brace_close(std::string_view s, size_t from) {
+    int depth = 1;
+    for (size_t i = from; i < s.size(); ++i) {
+        if (s[i] == '\\') {
+            ++i;
+        } else if (s[i] == '{') {
+            ++depth;
+        } else if (s[i] == '}' && --depth == 0) {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+// Body of ${...}: NAME, #NAME, NAME:-word or NAME-word. Anything else is
+// left in place as written.
+void expand_braced(std::string_view body, std::string& out) {
+    std::string_view whole = body;
+    bool length = body.size() > 1 && body[0] == '#';
+    if (length) body.remove_prefix(1);
+    size_t j = 0;
+    if (!body.empty() && is_name_start(body[0])) {
+        while (j < body.size() && is_name_char(body[j])) ++j;
+    }
+    if (j == 0 && !length && !body.empty() && isdigit(static_cast<unsigned char>(body[0]))) {
+        // ${N}, ${10}: positional parameters
+        while (j < body.size() && isdigit(static_cast<unsigned char>(body[j]))) ++j;
+        if (j == body.size()) {
+            size_t k = std::stoul(std::string(body));
+            if (k == 0) out += script_name;
+            else if (k <= positional_params.size()) out += positional_params[k - 1];
+            return;
+        }
+        j = 0;
+    }
+    std::string_view rest = body.substr(j);
+    if (j == 0 || (length && !rest.empty())) {
+        out += "${";
+        out += whole;
+        out += '}';
+        return;
+    }
+    std::string_view value;
+    bool set = lookup_var(body.substr(0, j), value);
+    if (length) {
+        append_number(set ? value.size() : 0, out);
+    } else if (rest.empty()) {
+        if (set) out += value;
+    } else if (rest.substr(0, 2) == ":-") {
+        if (set && !value.empty()) out += value;
+        else expand_word_into(rest.substr(2), out);
+    } else if (rest[0] == '-') {
+        if (set) out += value;
+        else expand_word_into(rest.substr(1), out);
+    } else {
+        out += "${";
+        out += whole;
+        out += '}';
+    }
+}
+
+// Expand the reference starting at s[i] == '$'; returns the index after it.
+size_t expand_dollar(std::string_view s, size_t i, std::string& out) {
+    size_t n = s.size();
+    char c = i + 1 < n ? s[i + 1] : '\0';
+    if (c == '?') {
+        append_number(last_status, out);
+        return i + 2;
+    }
+    if (c == '$') {
+        append_number(getpid(), out);
+        return i + 2;
+    }
+    if (c == '#') {
+        append_number(positional_params.size(), out);
+        return i + 2;
+    }
+    if (c == '@' || c == '*') {
+        // No field splitting: all arguments, joined by spaces
+        for (size_t k = 0; k < positional_params.size(); ++k) {
+            if (k) out += ' ';
+            out += positional_params[k];
+        }
+        return i + 2;
+    }
+    if (isdigit(static_cast<unsigned char>(c))) {
+        size_t k = c - '0';
+        if (k == 0) out += script_name;
+        else if (k <= positional_params.size()) out += positional_params[k - 1];
+        return i + 2;
+    }
+    if (is_name_start(c)) {
+        size_t j = i + 1;
+        while (j < n && is_name_char(s[j])) ++j;
+        std::string_view value;
+        if (lookup_var(s.substr(i + 1, j - i - 1), value)) out += value;
+        return j;
+    }
+    if (c == '{') {
+        size_t close = find_brace_close(s, i + 2);
+        if (close == std::string_view::npos) {
+            out += s.substr(i);
+            return n;
+        }
+        expand_braced(s.substr(i + 2, close - i - 2), out);
+        return close + 1;
+    }
+    out += '$';
+    return i + 1;
+}
+
+// Glob pattern mode: text that must match literally (quoted, escaped or
+// produced by an expansion) gets its metacharacters backslash-escaped.
+bool is_glob_meta(char c) {
+    return c == '*' || c == '?' || c == '[' || c == ']' || c == '{' || c == '}' || c == ',' || c == '\\';
+}
+
+void append_literal(std::string_view text, std::string& out, bool pattern) {
+    if (!pattern) {
+        out += text;
+        return;
+    }
+    for (char c : text) {
+        if (is_glob_meta(c)) out += '\\';
+        out += c;
+    }
+}
+
+void append_substitution(std::string_view command, std::string& out, bool pattern) {
+    if (!pattern) {
+        command_substitution(command, out);
+        return;
+    }
+    std::string value;
+    command_substitution(command, value);
+    append_literal(value, out, true);
+}
+
+size_t expand_dollar_literal(std::string_view s, size_t i, std::string& out, bool pattern) {
+    if (i + 1 < s.size() && s[i + 1] == '(') {
+        size_t close = find_subst_close(s, i + 2);
+        if (close == std::string_view::npos) {
+            append_literal(s.substr(i), out, pattern);
+            return s.size();
+        }
+        append_substitution(s.substr(i + 2, close - i - 2), out, pattern);
+        return close + 1;
+    }
+    if (!pattern) return expand_dollar(s, i, out);
+    std::string value;
+    i = expand_dollar(s, i, value);
+    append_literal(value, out, true);
+    return i;
+}
+
+// `...` at s[i]: inside, a backslash only quotes $ ` and \ (and " when
+// the backquotes are themselves in double quotes).
+size_t expand_backquote(std::string_view s, size_t i, std::string& out, bool pattern, bool in_dquote) {
+    size_t close = find_backquote_close(s, i + 1);
+    if (close == std::string_view::npos) {
+        append_literal(s.substr(i), out, pattern);
+        return s.size();
+    }
+    std::string command;
+    for (size_t j = i + 1; j < close; ++j) {
+        char c = s[j];
+        if (c == '\\' && j + 1 < close &&
+            (s[j + 1] == '$' || s[j + 1] == '`' || s[j + 1] == '\\' || (in_dquote && s[j + 1] == '"')))
+            c = s[++j];
+        command += c;
+    }
+    append_substitution(command, out, pattern);
+    return close + 1;
+}
+
+void expand_into(std::string_view raw, std::string& out, bool pattern) {
+    size_t n = raw.size();
+    size_t i = 0;
+    if (n && raw[0] == '~' && (n == 1 || raw[1] == '/')) {
+        std::string_view home;
+        if (lookup_var("HOME", home)) {
+            append_literal(home, out, pattern);
+            i = 1;
+        }
+    }
+    while (i < n) {
+        char c = raw[i];
+        if (c == '\\') {
+            append_literal(i + 1 < n ? raw.substr(i + 1, 1) : "\\", out, pattern);
+            i += 2;
+        } else if (c == '\'') {
+            size_t close = raw.find('\'', i + 1);
+            if (close == std::string_view::npos) close = n;
+            append_literal(raw.substr(i + 1, close - i - 1), out, pattern);
+            i = close + 1;
+        } else if (c == '"') {
+            for (++i; i < n && raw[i] != '"';) {
+                char d = raw[i];
+                if (d == '\\' && i + 1 < n &&
+                    (raw[i + 1] == '$' || raw[i + 1] == '`' || raw[i + 1] == '"' || raw[i + 1] == '\\')) {
+                    append_literal(raw.substr(i + 1, 1), out, pattern);
+                    i += 2;
+                } else if (d == '$') {
+                    i = expand_dollar_literal(raw, i, out, pattern);
+                } else if (d == '`') {
+                    i = expand_backquote(raw, i, out, pattern, true);
+                } else {
+                    append_literal(raw.substr(i, 1), out, pattern);
+                    ++i;
+                }
+            }
+            ++i;
+        } else if (c == '$') {
+            i = expand_dollar_literal(raw, i, out, pattern);
+        } else if (c == '`') {
+            i = expand_backquote(raw, i, out, pattern, false);
+        } else {
+            out += c;
+            ++i;
+        }
+    }
+}
+
+} // namespace
+
+bool lookup_var(std::string_view name, std::string_view& value) {
+    auto it = shell_vars.find(name);
+    if (it != shell_vars.end()) {
+        value = it->second;
+        return true;
+    }
+    char buf[256];
+    if (name.size() >= sizeof(buf)) return false;
+    memcpy(buf, name.data(), name.size());
+    buf[name.size()] = '\0';
+    const char* env = getenv(buf);
+    if (!env) return false;
+    value = env;
+    return true;
+}
+
+size_t find_subst_close(std::string_view s, size_t from) {
+    int depth = 1;
+    for (size_t i = from; i < s.size(); ++i) {
+        char c = s[i];
+        if (c == '\\') {
+            ++i;
+        } else if (c == '\'') {
+            i = s.find('\'', i + 1);
+            if (i == std::string_view::npos) return i;
+        } else if (c == '`') {
+            i = find_backquote_close(s, i + 1);
+            if (i == std::string_view::npos) return i;
+        } else if (c == '"') {
+            for (++i; i < s.size() && s[i] != '"'; ++i) {
+                if (s[i] == '\\') {
+                    ++i;
+                } else if (s[i] == '$' && i + 1 < s.size() && s[i + 1] == '(') {
+                    i = find_subst_close(s, i + 2);
+                    if (i == std::string_view::npos) return i;
+                } else if (s[i] == '`') {
+                    i = find_backquote_close(s, i + 1);
+                    if (i == std::string_view::npos) return i;
+                }
+            }
+            if (i >= s.size()) return std::string_view::npos;
+        } else if (c == '(') {
+            ++depth;
+        } else if (c == ')' && --depth == 0) {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+size_t find_backquote_close(std::string_view s, size_t from) {
+    for (size_t i = from; i < s.size(); ++i) {
+        if (s[i] == '\\') ++i;
+        else if (s[i] == '`') return i;
+    }
+    return std::string_view::npos;
+}
+
+void expand_word_into(std::string_view raw, std::string& out) {
+    expand_into(raw, out, false);
+}
+
+void expand_pattern_into(std::string_view raw, std::string& out) {
+    expand_into(raw, out, true);
+}
+
+std::string expand_word(std::string_view raw) {
+    std::string out;
+    out.reserve(raw.size());
+    expand_word_into(raw, out);
+    return out;
+}
+
+void expand_vars_into(std::string_view text, std::string& out) {
+    size_t i = 0;
+    while (i < text.size()) {
+        size_t dollar = text.find('$', i);
+        if (dollar == std::string_view::npos) {
+            out += text.substr(i);
+            break;
+        }
+        out += text.substr(i, dollar - i);
+        i = expand_dollar(text, dollar, out);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef GOONSH_EXPAND_H
+#define GOONSH_EXPAND_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Single-pass word expansion: a leading ~ or ~/, $NAME, ${NAME},
+// ${NAME:-word}, ${NAME-word}, ${#NAME}, $?, $$, and the positional
+// parameters $0-$9, ${N}, $# and $@/$*, and command substitution with
+// $(...) or `...` (see subst.h). Variables are read from shell_vars first
+// and the environment second. As in zsh, unquoted expansions are not
+// field-split.
+
+// Expand a raw word from the lexer and remove its quotes.
+std::string expand_word(std::string_view raw);
+void expand_word_into(std::string_view raw, std::string& out);
+// Like expand_word_into, for a word that will be globbed: everything that
+// must match literally (quoted or escaped text, expansion results) comes
+// out with its glob metacharacters backslash-escaped.
+void expand_pattern_into(std::string_view raw, std::string& out);
+// Expand $-references in text that carries no quoting (paths, config
+// values). Command substitutions are left as written: this runs on every
+// completion keystroke.
+void expand_vars_into(std::string_view text, std::string& out);
+// Value of a shell or environment variable; false if it is unset.
+bool lookup_var(std::string_view name, std::string_view& value);
+
+// Index of the ')' closing a "$(" whose body starts at `from`, skipping
+// quotes, escapes and nested substitutions; npos if it is unterminated.
+size_t find_subst_close(std::string_view s, size_t from);
+// Index of the '`' closing a backquote whose body starts at `from`, or npos.
+size_t find_backquote_close(std::string_view s, size_t from);
+
+#endif // GOONSH_EXPAND_H
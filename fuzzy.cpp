@@ -0,0 +1,184 @@
+#include "fuzzy.h"
+#include <algorithm>
+#include <string>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Scoring constants from fzf: a match is worth 16, a gap costs 3 to open
+// and 1 per extra character, and boundary bonuses are about half a match.
+constexpr int SCORE_MATCH = 16;
+constexpr int GAP_START = -3;
+constexpr int GAP_EXTENSION = -1;
+constexpr int BONUS_BOUNDARY = SCORE_MATCH / 2;
+constexpr int BONUS_BOUNDARY_WHITE = BONUS_BOUNDARY + 2;
+constexpr int BONUS_BOUNDARY_DELIMITER = BONUS_BOUNDARY + 1;
+constexpr int BONUS_NON_WORD = SCORE_MATCH / 2;
+constexpr int BONUS_CAMEL123 = BONUS_BOUNDARY - 1;
+constexpr int BONUS_CONSECUTIVE = -(GAP_START + GAP_EXTENSION);
+constexpr int BONUS_FIRST_CHAR_MULTIPLIER = 2;
+
+enum CharClass { White, NonWord, Delimiter, Lower, Upper, Number };
+
+CharClass char_class(unsigned char c) {
+    if (c >= 'a' && c <= 'z') return Lower;
+    if (c >= 'A' && c <= 'Z') return Upper;
+    if (c >= '0' && c <= '9') return Number;
+    if (c == ' ' || c == '\t' || c == '\n') return White;
+    if (c == '/' || c == ',' || c == ':' || c == ';' || c == '|') return Delimiter;
+    // Bytes of UTF-8 sequences count as letters
+    return c >= 0x80 ? Lower : NonWord;
+}
+
+int bonus_for(CharClass prev, CharClass cls) {
+    if (cls > Delimiter) {
+        if (prev == White) return BONUS_BOUNDARY_WHITE;
+        if (prev == Delimiter) return BONUS_BOUNDARY_DELIMITER;
+        if (prev == NonWord) return BONUS_BOUNDARY;
+    }
+    if ((prev == Lower && cls == Upper) || (prev != Number && cls == Number)) return BONUS_CAMEL123;
+    if (cls == NonWord || cls == Delimiter) return BONUS_NON_WORD;
+    if (cls == White) return BONUS_BOUNDARY_WHITE;
+    return 0;
+}
+
+inline unsigned char fold(unsigned char c, bool on) {
+    return on && c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+struct Pattern {
+    std::string chars;
+    bool fold;  // smart case: no uppercase in the pattern
+};
+
+Pattern make_pattern(std::string_view text) {
+    Pattern p{std::string(text), true};
+    for (char c : text)
+        if (c >= 'A' && c <= 'Z') p.fold = false;
+    return p;
+}
+
+// Is the pattern a subsequence of `s`? Sixteen candidate bytes at a time:
+// one compare per pattern character gives a bitmask of where it occurs in
+// the block, and the lowest bit past the previous match is the next match.
+bool is_subsequence(const Pattern& p, std::string_view s) {
+    const size_t m = p.chars.size();
+    if (m == 0) return true;
+    if (s.size() < m) return false;
+    size_t j = 0, i = 0;
+#if defined(__SSE2__)
+    const __m128i before_a = _mm_set1_epi8('A' - 1);
+    const __m128i after_z = _mm_set1_epi8('Z' + 1);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    for (; i + 16 <= s.size(); i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + i));
+        if (p.fold) {
+            __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(block, before_a), _mm_cmplt_epi8(block, after_z));
+            block = _mm_or_si128(block, _mm_and_si128(upper, case_bit));
+        }
+        unsigned from = 0;
+        while (j < m) {
+            unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(p.chars[j])));
+            mask &= 0xffffu << from;
+            if (!mask) break;
+            from = __builtin_ctz(mask) + 1;
+            if (++j == m) return true;
+        }
+    }
+#endif
+    for (; i < s.size(); ++i)
+        if (fold(s[i], p.fold) == static_cast<unsigned char>(p.chars[j]) && ++j == m) return true;
+    return j == m;
+}
+
+// fzf's v1 algorithm: take the first occurrence of the pattern, then walk
+// back from its end to find the shortest window containing it, and score
+// the characters of that window.
+int score(const Pattern& p, std::string_view s) {
+    const size_t m = p.chars.size();
+    if (m == 0) return 0;
+    auto at = [&](size_t i) { return fold(s[i], p.fold); };
+    auto pat = [&](size_t j) { return static_cast<unsigned char>(p.chars[j]); };
+    size_t j = 0, end = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (at(i) == pat(j) && ++j == m) {
+            end = i + 1;
+            break;
+        }
+    }
+    if (j < m) return -1;
+    size_t start = end;
+    for (size_t k = m; k > 0;) {
+        --start;
+        if (at(start) == pat(k - 1)) --k;
+    }
+
+    int total = 0, consecutive = 0, first_bonus = 0;
+    bool in_gap = false;
+    CharClass prev = start > 0 ? char_class(s[start - 1]) : White;
+    j = 0;
+    for (size_t i = start; i < end; ++i) {
+        CharClass cls = char_class(s[i]);
+        if (at(i) == pat(j)) {
+            total += SCORE_MATCH;
+            int bonus = bonus_for(prev, cls);
+            if (consecutive == 0) {
+                first_bonus = bonus;
+            } else {
+                // A run keeps the bonus of the boundary it started on
+                if (bonus >= BONUS_BOUNDARY && bonus > first_bonus) first_bonus = bonus;
+                bonus = std::max({bonus, first_bonus, BONUS_CONSECUTIVE});
+            }
+            total += j == 0 ? bonus * BONUS_FIRST_CHAR_MULTIPLIER : bonus;
+            in_gap = false;
+            ++consecutive;
+            ++j;
+        } else {
+            total += in_gap ? GAP_EXTENSION : GAP_START;
+            in_gap = true;
+            consecutive = 0;
+            first_bonus = 0;
+        }
+        prev = cls;
+    }
+    return total;
+}
+
+} // namespace
+
+int fuzzy_score(std::string_view pattern, std::string_view candidate) {
+    Pattern p = make_pattern(pattern);
+    return is_subsequence(p, candidate) ? score(p, candidate) : -1;
+}
+
+std::vector<FuzzyMatch> fuzzy_rank(std::string_view pattern, const std::vector<std::string_view>& candidates,
+                                   size_t limit) {
+    std::vector<FuzzyMatch> top;
+    if (limit == 0) return top;
+    Pattern p = make_pattern(pattern);
+    // Better first: higher score, then shorter, then earlier
+    auto better = [&](const FuzzyMatch& a, const FuzzyMatch& b) {
+        if (a.score != b.score) return a.score > b.score;
+        size_t la = candidates[a.index].size(), lb = candidates[b.index].size();
+        if (la != lb) return la < lb;
+        return a.index < b.index;
+    };
+    // A heap of the best `limit` so far with the worst of them on top
+    top.reserve(std::min(limit, candidates.size()));
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (!is_subsequence(p, candidates[i])) continue;
+        FuzzyMatch match{static_cast<uint32_t>(i), score(p, candidates[i])};
+        if (top.size() < limit) {
+            top.push_back(match);
+            std::push_heap(top.begin(), top.end(), better);
+        } else if (better(match, top.front())) {
+            std::pop_heap(top.begin(), top.end(), better);
+            top.back() = match;
+            std::push_heap(top.begin(), top.end(), better);
+        }
+    }
+    std::sort_heap(top.begin(), top.end(), better);
+    return top;
+}
@@ -0,0 +1,29 @@
+#ifndef GOONSH_FUZZY_H
+#define GOONSH_FUZZY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// fzf-style fuzzy matching for completion. A candidate matches when the
+// pattern is a subsequence of it; matches score higher the more pattern
+// characters land on word boundaries (start, after / - _ . or a space,
+// camelCase humps) and the fewer gaps there are between them. Matching is
+// case-insensitive unless the pattern has an uppercase letter.
+
+struct FuzzyMatch {
+    uint32_t index;  // into the candidate list
+    int score;
+};
+
+// Score of `candidate` against `pattern`, or -1 if it doesn't match.
+int fuzzy_score(std::string_view pattern, std::string_view candidate);
+// The best `limit` matches, best first; ties go to the shorter candidate,
+// then to the earlier one. Candidates are rejected with a SIMD subsequence
+// test before anything is scored, and only `limit` results are ever kept
+// sorted, so this stays fast over 100k+ candidates.
+std::vector<FuzzyMatch> fuzzy_rank(std::string_view pattern, const std::vector<std::string_view>& candidates,
+                                   size_t limit);
+
+#endif // GOONSH_FUZZY_H
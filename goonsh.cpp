@@ -39,15 +39,22 @@
 #include <sstream>
 #include <iomanip>
 #include <chrono>
-#include <glob.h>
 #include <regex>
 #include "utils.h"
+#include "alias.h"
+#include "shell.h"
 #include "history.h"
 #include "config.h"
 #include "completion.h"
-
-// Definition for global heredoc fds
-std::vector<int> global_heredoc_fds;
+#include "cmdhash.h"
+#include "parser.h"
+#include "builtins.h"
+#include "exec.h"
+#include "jobs.h"
+#include "prompt.h"
+#include "script.h"
+#include "serve.h"
+#include "trace.h"
 
 #define COLOR_RESET   "\033[0m"
 #define COLOR_BLUE    "\033[34m"
@@ -59,12 +66,6 @@ std::vector<int> global_heredoc_fds;
 
 // Debug code removed
 
-std::vector<std::string> builtins = {"cd","ls","pwd","echo","cat","touch","rm","mkdir","rmdir","cp","mv","head","tail","grep","wc","whoami","date","env","export","unset","history","which","clear","alias","unalias","help","exit","quit","man","time","jobs","fg","bg"};
-std::map<std::string, std::string> aliases;
-std::map<std::string, std::string> shell_vars = {{"DGSH_THEME", "default"}};
-int last_status = 0;
-std::vector<pid_t> bg_jobs;
-
 // --- SIGWINCH handler (must be global for signal) ---
 void handle_winch(int /*sig*/) {
     struct winsize w;
@@ -74,238 +75,124 @@ void handle_winch(int /*sig*/) {
     // Let readline handle SIGWINCH internally
 }
 
-// --- Utility Functions ---
-std::string get_prompt(const std::string& ps1) {
-    std::ostringstream out;
-    for (size_t i = 0; i < ps1.size(); ++i) {
-        if (ps1[i] == '\\' && i+1 < ps1.size()) {
-            char c = ps1[++i];
-            if (c == 'u') {
-                struct passwd* pw = getpwuid(getuid());
-                out << (pw ? pw->pw_name : "?");
-            } else if (c == 'h') {
-                char hostname[256];
-                gethostname(hostname, sizeof(hostname));
-                out << hostname;
-            } else if (c == 'w') {
-                char cwd[PATH_MAX];
-                if (getcwd(cwd, sizeof(cwd))) out << cwd;
-            } else if (c == '$') {
-                out << (geteuid() == 0 ? "#" : "$ ");
-            } else {
-                out << '\\' << c;
-            }
-        } else {
-            out << ps1[i];
-        }
-    }
-    return out.str();
+// History keeps one line per entry: fold a multi-line command back into one.
+static void append_continuation(std::string& history_line, const std::string& more) {
+    size_t end = history_line.find_last_not_of(" \t");
+    std::string_view last = end == std::string::npos ? "" : std::string_view(history_line).substr(0, end + 1);
+    size_t word = last.find_last_of(" \t;");
+    std::string_view tail = last.substr(word == std::string_view::npos ? 0 : word + 1);
+    bool joins = tail.empty() || tail == "do" || tail == "then" || tail == "else" || tail == "{" ||
+                 last.back() == '|' || last.back() == '&' || last.back() == ';';
+    history_line += joins ? " " : "; ";
+    history_line += more;
 }
 
-struct CmdSegment {
-    std::vector<std::string> args;
-    std::string input_redir;
-    std::string output_redir;
-    std::string output_append_redir;
-    std::string heredoc_delim;
-    bool background = false;
-};
-
-static std::vector<std::string> tokenize_command_line(const std::string& line) {
-    std::vector<std::string> tokens;
-    std::string token;
-    bool in_single = false, in_double = false, escape = false;
-
-    auto flush_token = [&]() {
-        if (!token.empty()) {
-            tokens.push_back(token);
-            token.clear();
-        }
-    };
-
-    for (size_t i = 0; i < line.size(); ++i) {
-        char c = line[i];
-        if (escape) {
-            token += c;
-            escape = false;
-            continue;
+// --- Main Loop ---
+int main(int argc, char* argv[]) {
+    const char* usage =
+        "usage: dgsh [--startup-profile] [-c COMMANDS [NAME [ARG...]] | SCRIPT [ARG...] | --serve SOCKET]";
+    const char* command = nullptr;
+    const char* serve_path = nullptr;
+    int first_arg = 1;
+    for (; first_arg < argc && argv[first_arg][0] == '-'; ++first_arg) {
+        std::string_view opt = argv[first_arg];
+        if (opt == "--") {
+            ++first_arg;
+            break;
         }
-        if (c == '\\') {
-            escape = true;
+        if (opt == "--startup-profile") {
+            startup_profile_begin();
             continue;
         }
-        if (c == '\'' && !in_double) {
-            in_single = !in_single;
+        if (opt == "--serve" && first_arg + 1 < argc) {
+            serve_path = argv[++first_arg];
             continue;
         }
-        if (c == '"' && !in_single) {
-            in_double = !in_double;
-            continue;
+        if (opt == "-c" && first_arg + 1 < argc) {
+            command = argv[first_arg + 1];
+            first_arg += 2;
+            break;
         }
-        if (!in_single && !in_double) {
-            if (isspace(static_cast<unsigned char>(c))) {
-                flush_token();
-                continue;
-            }
-            if (c == '<' || c == '>' || c == '|' || c == '&') {
-                flush_token();
-                if ((c == '<' || c == '>') && i + 1 < line.size() && line[i + 1] == c) {
-                    tokens.emplace_back(2, c);
-                    ++i;
-                } else {
-                    tokens.emplace_back(1, c);
-                }
-                continue;
-            }
+        if (opt == "-c" || opt == "--serve") std::cerr << "dgsh: " << opt << ": option requires an argument" << std::endl;
+        else std::cerr << "dgsh: " << opt << ": invalid option" << std::endl;
+        std::cerr << usage << std::endl;
+        return 2;
+    }
+    // dgsh --serve SOCKET: a warm shell running dgsh-client requests
+    if (serve_path) {
+        if (command || first_arg < argc) {
+            std::cerr << usage << std::endl;
+            return 2;
         }
-        token += c;
+        return serve(serve_path);
     }
 
-    if (escape) token += '\\';
-    flush_token();
-    return tokens;
-}
-
-std::vector<CmdSegment> parse_pipeline(const std::string& line) {
-    std::vector<CmdSegment> segments;
-    CmdSegment seg;
-    auto tokens = tokenize_command_line(line);
-    for (size_t i = 0; i < tokens.size(); ++i) {
-        const std::string& tok = tokens[i];
-        if (tok == "|") {
-            segments.push_back(seg);
-            seg = CmdSegment();
-        } else if (tok == "<") {
-            if (i + 1 < tokens.size()) seg.input_redir = tokens[++i];
-        } else if (tok == ">") {
-            if (i + 1 < tokens.size()) seg.output_redir = tokens[++i];
-        } else if (tok == ">>") {
-            if (i + 1 < tokens.size()) seg.output_append_redir = tokens[++i];
-        } else if (tok == "<<") {
-            if (i + 1 < tokens.size()) seg.heredoc_delim = tokens[++i];
-        } else if (tok == "&") {
-            seg.background = true;
-        } else {
-            seg.args.push_back(tok);
-        }
+    // Only an interactive shell (a terminal, no script, no -c) gets its own
+    // process group, readline, history, completion, the config and the banner
+    bool terminal = isatty(STDIN_FILENO);
+    bool interactive = terminal && !command && first_arg == argc;
+    if (interactive) {
+        pid_t shell_pgid = getpid();
+        setpgid(shell_pgid, shell_pgid);
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
     }
-    if (!seg.args.empty() || !seg.input_redir.empty() || !seg.output_redir.empty() ||
-        !seg.output_append_redir.empty() || !seg.heredoc_delim.empty() || seg.background ||
-        segments.empty()) {
-        segments.push_back(seg);
+    // Jobs get the terminal and hand it back, which takes these ignored;
+    // with no terminal (piped input) there is nothing to juggle
+    if (terminal) {
+        signal(SIGTTOU, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
     }
-    return segments;
-}
+    jobs_init();
+    trace_init();
+    // Nothing completes command names without a prompt: skip indexing $PATH
+    if (!interactive) cmdhash_lazy();
+    startup_mark("init");
 
-int run_pipeline(std::vector<CmdSegment>& segments) {
-    extern std::vector<int> global_heredoc_fds; // Access heredoc fds
-    int n = segments.size();
-    int prev_fd = -1;
-    std::vector<pid_t> pids;
-    pid_t pgid = 0;
-    int shell_terminal = STDIN_FILENO;
-    int shell_pgid = getpgrp();
-    struct termios shell_tmodes;
-    tcgetattr(shell_terminal, &shell_tmodes);
-
-    for (int i = 0; i < n; ++i) {
-        int pipefd[2];
-        if (i < n-1) pipe(pipefd);
-        pid_t pid = fork();
-        if (pid == 0) {
-            setpgid(0, pgid ? pgid : getpid());
-            if (!segments.back().background)
-                tcsetpgrp(shell_terminal, getpid());
-            signal(SIGINT, SIG_DFL);
-            signal(SIGTSTP, SIG_DFL);
-            signal(SIGTTIN, SIG_DFL);
-            signal(SIGTTOU, SIG_DFL);
-            // Check for heredoc fd marker
-            int heredoc_fd = -1;
-            for (auto it = segments[i].args.begin(); it != segments[i].args.end(); ++it) {
-                if (it->find("__HEREDOC_FD__") == 0) {
-                    heredoc_fd = std::stoi(it->substr(14));
-                    segments[i].args.erase(it);
-                    break;
-                }
-            }
-            if (heredoc_fd != -1) {
-                dup2(heredoc_fd, 0);
-                close(heredoc_fd);
-            } else if (!segments[i].input_redir.empty()) {
-                int fd = open(segments[i].input_redir.c_str(), O_RDONLY);
-                if (fd >= 0) { dup2(fd, 0); close(fd); }
-            } else if (prev_fd != -1) {
-                dup2(prev_fd, 0); close(prev_fd);
-            }
-            if (!segments[i].output_redir.empty()) {
-                int fd = open(segments[i].output_redir.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
-                if (fd >= 0) { dup2(fd, 1); close(fd); }
-            } else if (!segments[i].output_append_redir.empty()) {
-                int fd = open(segments[i].output_append_redir.c_str(), O_WRONLY|O_CREAT|O_APPEND, 0666);
-                if (fd >= 0) { dup2(fd, 1); close(fd); }
-            } else if (i < n-1) {
-                dup2(pipefd[1], 1); close(pipefd[1]);
-            }
-            if (i < n-1) close(pipefd[0]);
-            std::vector<std::string> final_args;
-            for (auto& arg : segments[i].args) {
-                final_args.push_back(arg);
-            }
-            if (final_args.empty()) _exit(0);
-            char** argv = new char*[final_args.size()+1];
-            for (size_t j = 0; j < final_args.size(); ++j) argv[j] = strdup(final_args[j].c_str());
-            argv[final_args.size()] = nullptr;
-            // Debug print removed
-            execvp(argv[0], argv);
-            perror("execvp");
-            _exit(127);
-        } else if (pid > 0) {
-            if (prev_fd != -1) close(prev_fd);
-            if (i < n-1) { close(pipefd[1]); prev_fd = pipefd[0]; }
-            setpgid(pid, pgid ? pgid : pid);
-            if (!pgid) pgid = pid;
-            if (i == 0 && !segments.back().background) {
-                tcsetpgrp(shell_terminal, pid);
-            }
-            pids.push_back(pid);
-        } else {
-            perror("fork");
-            return 1;
-        }
+    // dgsh -c COMMANDS [NAME [ARG...]]: one script, its last command exec'd
+    if (command) {
+        if (first_arg < argc) script_name = argv[first_arg++];
+        positional_params.assign(argv + first_arg, argv + argc);
+        auto script = script_parse(command, "-c");
+        startup_mark("parse");
+        if (!script) return 2;
+        int status = script->root ? script_run(script, false, true) : 0;
+        startup_mark("run");
+        startup_profile_report("exit");
+        return status;
     }
-    int status = 0;
-    if (!segments.back().background) {
-        for (auto pid : pids) waitpid(pid, &status, WUNTRACED);
-        tcsetpgrp(shell_terminal, shell_pgid);
-        tcsetattr(shell_terminal, TCSADRAIN, &shell_tmodes);
-    } else {
-        for (auto pid : pids) bg_jobs.push_back(pid);
+
+    // Commands piped or redirected in: read in blocks, never through readline
+    if (first_arg == argc && !interactive) {
+        int status = script_run_fd(STDIN_FILENO, "");
+        startup_mark("run");
+        startup_profile_report("exit");
+        return status;
     }
-    // Cleanup heredoc fds
-    for (int fd : global_heredoc_fds) close(fd);
-    global_heredoc_fds.clear();
-    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
-}
 
-// --- Main Loop ---
-int main(int argc, char* argv[]) {
-    // Job control setup
-    pid_t shell_pgid = getpid();
-    setpgid(shell_pgid, shell_pgid);
-    tcsetpgrp(STDIN_FILENO, shell_pgid);
-    signal(SIGTTOU, SIG_IGN);
-    signal(SIGTTIN, SIG_IGN);
-    signal(SIGTSTP, SIG_IGN);
-    // signal(SIGWINCH, handle_winch); // Let readline handle SIGWINCH
+    // Scripting mode: dgsh file.sh [ARG...]
+    if (first_arg < argc) {
+        const char* path = argv[first_arg];
+        if (access(path, R_OK) != 0) { std::cerr << "Cannot open script: " << path << std::endl; return 1; }
+        script_name = path;
+        positional_params.assign(argv + first_arg + 1, argv + argc);
+        // Parsed once (or loaded from DGSH_SCRIPT_CACHE); a syntax error runs nothing
+        auto script = script_load(path);
+        startup_mark("script load");
+        if (!script) return 2;
+        int status = script_run(script);
+        startup_mark("script run");
+        startup_profile_report("exit");
+        return status;
+    }
 
     std::string line;
-    std::string ps1 = "[\\u@\\h \\w]$ ";
     std::string prompt;
     std::vector<std::string> rc_commands;
     load_config(aliases, prompt, rc_commands);
-    if (!prompt.empty()) ps1 = prompt;
-    load_history_file();
+    // Compiled once; only slow segments and the cwd change between prompts
+    const PromptTemplate ps1 = prompt_compile(prompt.empty() ? "[\\u@\\h \\w]$ " : prompt);
+    startup_mark("config");
     rl_attempted_completion_function = goonsh_completion;
     rl_bind_keyseq("\033[C", accept_suggestion); // Right arrow
     // Custom SIGINT handler for main shell
@@ -319,29 +206,54 @@ int main(int argc, char* argv[]) {
     };
     signal(SIGINT, sigint_handler);
     std::cout << COLOR_MAGENTA << "Welcome To dgsh >~< (Type 'help' for commands. 'exit' or 'quit' to leave)" << COLOR_RESET << std::endl;
+    // As in bash, aliases are for interactive use; scripts never see them
+    alias_expansion = true;
 
-    // Scripting mode: dgsh file.sh
-    if (argc == 2) {
-        std::ifstream script(argv[1]);
-        if (!script) { std::cerr << "Cannot open script: " << argv[1] << std::endl; return 1; }
-        while (std::getline(script, line)) {
-            if (line.empty() || line[0] == '#') continue;
-            auto segments = parse_pipeline(line);
-            last_status = run_pipeline(segments);
-        }
-        return last_status;
+    // Execute commands from ~/.dgshrc; builtins among them run in-process
+    if (!rc_commands.empty()) {
+        std::string rc_source;
+        for (const auto& rc_line : rc_commands) rc_source += rc_line + "\n";
+        auto rc = script_parse(std::move(rc_source), "~/.dgshrc");
+        if (rc) last_status = script_run(rc, true);
+        startup_mark("rc");
+        if (shell_exiting) return last_status;
     }
+    // History and the PATH index load while the first prompt waits for a
+    // key. Readline's history is needed from the first key on, the index
+    // from the first command lookup.
+    rl_pre_input_hook = [] {
+        rl_pre_input_hook = nullptr;
+        load_history_file_async();
+        cmdhash_prefetch();
+        return 0;
+    };
+    rl_getc_function = [](FILE* in) {
+        history_wait();
+        return rl_getc(in);
+    };
+    startup_profile_report("first prompt");
 
-    // Execute commands from ~/.dgshrc
-    for (const auto& rc_line : rc_commands) {
-        if (rc_line.empty()) continue;
-        auto segments = parse_pipeline(rc_line);
-        run_pipeline(segments);
-    }
+    // Here-document (<< delimiter) bodies typed after the command line
+    auto next_heredoc_line = [](std::string& l) {
+        char* heredoc_line = readline("> ");
+        if (!heredoc_line) {
+            std::cout << std::endl;
+            return false;
+        }
+        l = heredoc_line;
+        free(heredoc_line);
+        return true;
+    };
+    script_heredoc_lines = next_heredoc_line;
 
     while (true) {
-        prompt = get_prompt(ps1);
-        char* input = readline(prompt.c_str());
+        jobs_notify(true);
+        prompt = prompt_render(ps1);
+        char* input;
+        {
+            TraceSpan span("readline");
+            input = readline(prompt.c_str());
+        }
         if (!input) {
             std::cout << "exit" << std::endl;
             break;
@@ -354,18 +266,50 @@ int main(int argc, char* argv[]) {
             std::cerr << "Error: input line too long (max " << MAX_INPUT_LEN << " chars)" << std::endl;
             continue;
         }
-        // Remove comments (not inside quotes)
-        bool in_single = false, in_double = false;
-        for (size_t i = 0; i < line.size(); ++i) {
-            if (line[i] == '"' && !in_single) in_double = !in_double;
-            else if (line[i] == '\'' && !in_double) in_single = !in_single;
-            else if (line[i] == '#' && !in_single && !in_double) { line = line.substr(0, i); break; }
+        // Lines that open an if/while/for/{ or end in && || | go on at "> "
+        bool incomplete;
+        std::string history_line = line;
+        auto script = script_parse(line, "", &incomplete);
+        while (incomplete) {
+            char* more = readline("> ");
+            if (!more) {
+                std::cerr << "dgsh: syntax error: unexpected end of file" << std::endl;
+                break;
+            }
+            line += '\n';
+            line += more;
+            append_continuation(history_line, more);
+            free(more);
+            script = script_parse(line, "", &incomplete);
+        }
+        // Blank and comment-only lines parse to nothing
+        if (script && !script->root) continue;
+        history_append(history_line);
+        if (!script) {
+            last_status = 2;
+            continue;
+        }
+        if (!script_is_simple(*script)) {
+            // Lists and control flow: the engine runs them, with ^C left to the jobs
+            struct sigaction old_int, ign;
+            ign.sa_handler = SIG_IGN;
+            sigemptyset(&ign.sa_mask);
+            ign.sa_flags = 0;
+            sigaction(SIGINT, &ign, &old_int);
+            last_status = script_run(script, true);
+            sigaction(SIGINT, &old_int, nullptr);
+            if (shell_exiting) {
+                std::cout << "Bye!" << std::endl;
+                break;
+            }
+            continue;
         }
-        if (line.find_first_not_of(" \t\r\n") == std::string::npos) continue;
-        add_history(line.c_str());
-        auto segments = parse_pipeline(line);
+        bool timed = script->root->pipeline->timed;
+        auto segments = lower_pipeline(*script->root->pipeline);
+        // Here-document (<< delimiter) bodies are read before anything runs
+        if (!collect_heredocs(segments, next_heredoc_line)) continue;
         // If single command, not background, and is a builtin, run in parent
-        if (segments.size() == 1 && !segments[0].background && !segments[0].args.empty()) {
+        if (segments.size() == 1 && !segments[0].background && !timed && !segments[0].args.empty()) {
             std::string cmd = segments[0].args[0];
             static const std::map<std::string, std::string> builtin_help = {
                 {"cd",    "Usage: cd [DIR]\nChange the current directory to DIR."},
@@ -376,22 +320,17 @@ int main(int argc, char* argv[]) {
                 {"touch", "Usage: touch [FILE]...\nChange file timestamps."},
                 {"mkdir", "Usage: mkdir [DIRECTORY]...\nCreate the DIRECTORY(ies), if they do not already exist."}
             };
-            // Only handle true builtins
-            if (cmd == "exit") {
-                std::cout << "Bye!" << std::endl;
-                break;
-            } else if (cmd == "help") {
-                std::cout << "Available commands:\n";
-                for (const auto& b : builtins) std::cout << "  " << b << std::endl;
-                continue;
-            } else if (cmd == "cd") {
-                const char* target = (segments[0].args.size() > 1) ? segments[0].args[1].c_str() : getenv("HOME");
-                if (chdir(target) != 0) perror("cd");
+            // True builtins run in the shell process
+            if (run_builtin(segments[0], last_status)) {
+                close_heredocs(segments[0]);
+                if (shell_exiting) {
+                    std::cout << "Bye!" << std::endl;
+                    break;
+                }
                 continue;
             }
             // Special case: cat with no arguments, print help and do not run
-            if (cmd == "cat" && segments[0].args.size() == 1 &&
-                segments[0].input_redir.empty() && segments[0].heredoc_delim.empty()) {
+            if (cmd == "cat" && segments[0].args.size() == 1 && segments[0].redirs.empty()) {
                 auto it = builtin_help.find(cmd);
                 if (it != builtin_help.end()) {
                     std::cout << it->second << std::endl;
@@ -401,49 +340,6 @@ int main(int argc, char* argv[]) {
                 continue;
             }
         }
-        // Improved here-document (<< delimiter) support
-        std::vector<int> heredoc_fds; // To track open heredoc pipes for cleanup
-        bool heredoc_aborted = false;
-        for (auto& seg : segments) {
-            if (seg.heredoc_delim.empty()) continue;
-
-            std::string heredoc;
-            while (true) {
-                char* heredoc_line = readline("> ");
-                if (!heredoc_line) {
-                    heredoc_aborted = true;
-                    std::cout << std::endl;
-                    break;
-                }
-
-                std::string inputline = heredoc_line;
-                free(heredoc_line);
-                if (inputline == seg.heredoc_delim) break;
-                heredoc += inputline + "\n";
-            }
-
-            if (heredoc_aborted) break;
-
-            int pipefd[2];
-            if (pipe(pipefd) == -1) {
-                perror("pipe");
-                heredoc_aborted = true;
-                break;
-            }
-
-            write(pipefd[1], heredoc.c_str(), heredoc.size());
-            close(pipefd[1]);
-            seg.input_redir.clear();
-            seg.args.push_back("__HEREDOC_FD__" + std::to_string(pipefd[0]));
-            heredoc_fds.push_back(pipefd[0]);
-        }
-
-        if (heredoc_aborted) {
-            for (int fd : heredoc_fds) close(fd);
-            continue;
-        }
-        // Pass heredoc_fds to run_pipeline via a static/global (for simplicity)
-        global_heredoc_fds = heredoc_fds;
         // Ignore SIGINT and set SIGWINCH to default while running external commands
         struct sigaction old_int, old_winch, ign, def;
         ign.sa_handler = SIG_IGN;
@@ -454,11 +350,10 @@ int main(int argc, char* argv[]) {
         def.sa_flags = 0;
         sigaction(SIGINT, &ign, &old_int);
         sigaction(SIGWINCH, &def, &old_winch);
-        last_status = run_pipeline(segments);
+        last_status = execute(segments, timed);
         // Restore custom handlers after command execution
         sigaction(SIGINT, &old_int, nullptr);
         sigaction(SIGWINCH, &old_winch, nullptr);
-        save_history_file();
     }
     return 0;
 }
@@ -1,16 +1,547 @@
 #include "history.h"
+#include "histstats.h"
 #include <cstdio>
 #include <readline/readline.h>
 #include <readline/history.h>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <climits>
+#include <csignal>
+#include <cstdint>
 #include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
 #include <string>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
 const std::string HISTORY_FILE = std::string(getenv("HOME")) + "/.dgsh_history";
+const std::string STATS_FILE = HISTORY_FILE + ".stats";
+
+// Prefix index over unique history lines. Lines are kept sorted so every
+// prefix maps to one contiguous range. Each slot carries the sequence
+// number of the line's latest use and a copy of its usage statistics, and
+// per-block maxima over those bound the best score a block can hold, so a
+// lookup skips most of a large range without scoring it.
+namespace {
+
+const size_t BLOCK = 64;
+
+struct Slot {
+    uint64_t stamp;      // sequence number of the latest use
+    uint64_t cwd;        // from the line's CommandStats
+    uint32_t count;
+    uint32_t last_used;
+};
+
+struct BlockMax {
+    uint64_t stamp;
+    uint32_t count;
+    uint32_t last_used;
+};
+
+struct HistoryIndex {
+    std::deque<std::string> lines;                       // stable storage, one per unique line
+    std::vector<uint64_t> hashes;                        // command_hash() per line id
+    std::unordered_map<std::string_view, uint32_t> ids;  // line text -> id
+    std::vector<uint32_t> order;                         // ids, sorted by text
+    std::vector<Slot> slots;                             // parallel to order
+    std::vector<BlockMax> blocks;                        // max per BLOCK slots
+    uint64_t seq = 0;
+};
+
+HistoryIndex idx;
+// Usage statistics: everything known (`stats`), and what this session has
+// added since it last saved them (`session`).
+StatsTable stats;
+StatsTable session;
+
+std::string_view text_at(size_t pos) {
+    return idx.lines[idx.order[pos]];
+}
+
+// Hash of the current directory, recomputed after history_cwd_changed()
+bool cwd_known = false;
+
+uint64_t cwd_hash() {
+    static uint64_t cached;
+    if (!cwd_known) {
+        char buf[PATH_MAX];
+        cached = getcwd(buf, sizeof(buf)) ? command_hash(buf) : 0;
+        cwd_known = true;
+    }
+    return cached;
+}
+
+// Copy a line's statistics into its slot.
+void load_slot_stats(size_t pos) {
+    Slot& slot = idx.slots[pos];
+    const CommandStats* s = stats.find(idx.hashes[idx.order[pos]]);
+    slot.cwd = s ? s->cwd : 0;
+    slot.count = s ? s->count : 0;
+    slot.last_used = s ? s->last_used : 0;
+}
+
+void rebuild_blocks(size_t from_block) {
+    idx.blocks.resize((idx.slots.size() + BLOCK - 1) / BLOCK);
+    for (size_t b = from_block; b < idx.blocks.size(); ++b) {
+        size_t end = std::min(idx.slots.size(), (b + 1) * BLOCK);
+        BlockMax m{0, 0, 0};
+        for (size_t i = b * BLOCK; i < end; ++i) {
+            m.stamp = std::max(m.stamp, idx.slots[i].stamp);
+            m.count = std::max(m.count, idx.slots[i].count);
+            m.last_used = std::max(m.last_used, idx.slots[i].last_used);
+        }
+        idx.blocks[b] = m;
+    }
+}
+
+// Statistics changed underneath the index (loaded or merged from disk).
+void refresh_slot_stats() {
+    for (size_t pos = 0; pos < idx.slots.size(); ++pos) load_slot_stats(pos);
+    rebuild_blocks(0);
+}
+
+size_t lower_pos(std::string_view s) {
+    return std::partition_point(idx.order.begin(), idx.order.end(),
+                                [&](uint32_t id) { return std::string_view(idx.lines[id]) < s; }) -
+           idx.order.begin();
+}
+
+void index_line(std::string_view line) {
+    uint64_t stamp = ++idx.seq;
+    auto it = idx.ids.find(line);
+    if (it != idx.ids.end()) {
+        size_t pos = lower_pos(line);
+        idx.slots[pos].stamp = stamp;
+        load_slot_stats(pos);
+        // Uses only ever raise a slot's values, so the block max just follows
+        BlockMax& m = idx.blocks[pos / BLOCK];
+        m.stamp = stamp;
+        m.count = std::max(m.count, idx.slots[pos].count);
+        m.last_used = std::max(m.last_used, idx.slots[pos].last_used);
+        return;
+    }
+    uint32_t id = idx.lines.size();
+    idx.lines.emplace_back(line);
+    idx.hashes.push_back(command_hash(line));
+    idx.ids.emplace(idx.lines.back(), id);
+    size_t pos = lower_pos(line);
+    idx.order.insert(idx.order.begin() + pos, id);
+    idx.slots.insert(idx.slots.begin() + pos, Slot{stamp, 0, 0, 0});
+    load_slot_stats(pos);
+    rebuild_blocks(pos / BLOCK);
+}
+
+} // namespace
+
+// ~/.dgsh_history is an append-only log of "#<epoch>\n<command>\n" records
+// (readline's timestamped format; plain lines without a timestamp load too).
+// Each command is appended with a single O_APPEND write under a shared
+// flock, so concurrent sessions interleave whole records and never
+// rewrite each other's. Once the file outgrows HISTORY_FILE_CAP, a
+// background thread takes the lock exclusively and swaps in a copy that
+// keeps the newest half; appenders notice the new inode and reopen.
+namespace {
+
+const off_t HISTORY_FILE_CAP = 4 << 20;
+std::atomic<bool> compacting{false};
+
+bool is_timestamp(std::string_view line) {
+    return line.size() > 1 && line[0] == '#' &&
+           line.find_first_not_of("0123456789", 1) == std::string_view::npos;
+}
+
+bool same_file(int fd, const std::string& path) {
+    struct stat fst, pst;
+    return fstat(fd, &fst) == 0 && stat(path.c_str(), &pst) == 0 && fst.st_ino == pst.st_ino &&
+           fst.st_dev == pst.st_dev;
+}
+
+bool write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+void compact_history_file() {
+    int fd = open(HISTORY_FILE.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    flock(fd, LOCK_EX);
+    struct stat st;
+    // Someone else may have compacted while we waited for the lock
+    if (fstat(fd, &st) != 0 || st.st_size <= HISTORY_FILE_CAP || !same_file(fd, HISTORY_FILE)) {
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+    std::string_view data(static_cast<const char*>(map), size);
+    // Keep whole lines from the midpoint of the cap onwards...
+    size_t cut = data.find('\n', size - HISTORY_FILE_CAP / 2);
+    cut = cut == std::string_view::npos ? size : cut + 1;
+    // ...without separating a command from the timestamp line above it
+    if (cut >= 2 && cut < size) {
+        size_t prev = data.rfind('\n', cut - 2);
+        prev = prev == std::string_view::npos ? 0 : prev + 1;
+        if (is_timestamp(data.substr(prev, cut - 1 - prev))) cut = prev;
+    }
+    std::string tmp = HISTORY_FILE + ".compact." + std::to_string(getpid());
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    bool ok = out >= 0 && write_all(out, data.data() + cut, size - cut) && fdatasync(out) == 0;
+    if (out >= 0) close(out);
+    if (ok) ok = rename(tmp.c_str(), HISTORY_FILE.c_str()) == 0;
+    if (!ok) unlink(tmp.c_str());
+    munmap(map, size);
+    close(fd);
+}
+
+void append_history_record(const std::string& line) {
+    std::string record = "#" + std::to_string(time(nullptr)) + "\n" + line + "\n";
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        int fd = open(HISTORY_FILE.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) return;
+        flock(fd, LOCK_SH);
+        // The file was compacted between our open() and flock(); retry on the new one
+        if (!same_file(fd, HISTORY_FILE)) {
+            close(fd);
+            continue;
+        }
+        write_all(fd, record.data(), record.size());
+        struct stat st;
+        bool over_cap = fstat(fd, &st) == 0 && st.st_size > HISTORY_FILE_CAP;
+        close(fd);
+        if (over_cap && !compacting.exchange(true)) {
+            // The thread inherits our mask: keep SIGCHLD (and friends) on the main thread
+            sigset_t all, old;
+            sigfillset(&all);
+            pthread_sigmask(SIG_SETMASK, &all, &old);
+            std::thread([] {
+                compact_history_file();
+                compacting = false;
+            }).detach();
+            pthread_sigmask(SIG_SETMASK, &old, nullptr);
+        }
+        return;
+    }
+}
+
+// ~/.dgsh_history.stats holds the usage statistics as a StatsTable image,
+// so startup loads them with one read instead of replaying the log. A
+// session saves by merging what it added since its last save into the
+// file's current contents under an exclusive flock and renaming a new file
+// into place, like compaction does; sessions add up rather than overwrite
+// each other. Saves happen every STATS_SAVE_EVERY commands and at exit.
+const size_t STATS_SAVE_EVERY = 32;
+// Past this many unique commands, the least recently used quarter goes
+const size_t STATS_CAP = 1 << 17;
+size_t unsaved_uses = 0;
+pid_t stats_owner = 0;  // forked children must not save
+
+bool read_all(int fd, std::string& out) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return false;
+    out.resize(st.st_size);
+    size_t got = 0;
+    while (got < out.size()) {
+        ssize_t n = pread(fd, &out[got], out.size() - got, got);
+        if (n <= 0) return false;
+        got += n;
+    }
+    return true;
+}
+
+bool load_stats_file() {
+    int fd = open(STATS_FILE.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    flock(fd, LOCK_SH);
+    std::string data;
+    bool ok = read_all(fd, data) && stats.deserialize(data);
+    close(fd);
+    return ok;
+}
+
+void save_stats() {
+    if (session.size() == 0 || getpid() != stats_owner) return;
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        int fd = open(STATS_FILE.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) return;
+        flock(fd, LOCK_EX);
+        // Another session renamed a new file in while we waited; merge into that
+        if (!same_file(fd, STATS_FILE)) {
+            close(fd);
+            continue;
+        }
+        std::string data;
+        StatsTable merged;
+        if (read_all(fd, data) && !data.empty()) merged.deserialize(data);
+        for (const auto& s : session.slots()) {
+            if (s.hash == 0) continue;
+            CommandStats& m = merged.upsert(s.hash);
+            m.count += s.count;
+            if (s.last_used >= m.last_used) {
+                m.last_used = s.last_used;
+                m.cwd = s.cwd;
+            }
+        }
+        if (merged.size() > STATS_CAP) merged.trim(STATS_CAP * 3 / 4);
+        data = merged.serialize();
+        std::string tmp = STATS_FILE + ".tmp." + std::to_string(getpid());
+        int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        bool ok = out >= 0 && write_all(out, data.data(), data.size());
+        if (out >= 0) close(out);
+        if (ok) ok = rename(tmp.c_str(), STATS_FILE.c_str()) == 0;
+        if (!ok) unlink(tmp.c_str());
+        close(fd);
+        if (!ok) return;
+        // Now includes every other session's uses too
+        stats = std::move(merged);
+        session = StatsTable();
+        unsaved_uses = 0;
+        refresh_slot_stats();
+        return;
+    }
+}
+
+void record_use(StatsTable& table, uint64_t hash, uint32_t when, uint64_t cwd) {
+    CommandStats& s = table.upsert(hash);
+    ++s.count;
+    if (when >= s.last_used) {
+        s.last_used = when;
+        s.cwd = cwd;
+    }
+}
+
+// History read by the loader, waiting for the main thread to hand it to
+// readline. Entries point into the file, mapped read-only: no copy of it
+// is made until readline takes the lines.
+struct Staged {
+    const char* map = nullptr;
+    size_t size = 0;
+    std::vector<std::pair<std::string_view, std::string_view>> entries;  // line, timestamp or empty
+};
+
+Staged staged;
+// Started by load_history_file_async(), joined by history_wait().
+std::thread loader;
+
+// No stats file yet: count what the text history has, once. Its timestamps
+// give last use; the directory is unknown.
+void stats_from_history() {
+    for (const auto& e : staged.entries) {
+        uint32_t when = 0;
+        if (!e.second.empty()) std::from_chars(e.second.data() + 1, e.second.data() + e.second.size(), when);
+        uint64_t h = command_hash(e.first);
+        record_use(stats, h, when, 0);
+        record_use(session, h, when, 0);
+    }
+}
+
+void reindex(const std::vector<std::string_view>& lines) {
+    idx = HistoryIndex();
+    std::vector<uint64_t> last_use;
+    for (std::string_view line : lines) {
+        uint64_t stamp = ++idx.seq;
+        auto it = idx.ids.find(line);
+        if (it != idx.ids.end()) {
+            last_use[it->second] = stamp;
+            continue;
+        }
+        idx.lines.emplace_back(line);
+        idx.hashes.push_back(command_hash(line));
+        idx.ids.emplace(idx.lines.back(), idx.lines.size() - 1);
+        last_use.push_back(stamp);
+    }
+    idx.order.resize(idx.lines.size());
+    for (uint32_t i = 0; i < idx.order.size(); ++i) idx.order[i] = i;
+    std::sort(idx.order.begin(), idx.order.end(),
+              [](uint32_t a, uint32_t b) { return idx.lines[a] < idx.lines[b]; });
+    idx.slots.resize(idx.order.size());
+    for (size_t pos = 0; pos < idx.order.size(); ++pos) idx.slots[pos].stamp = last_use[idx.order[pos]];
+    refresh_slot_stats();
+}
+
+// Everything but readline's part: read and split the file, load the stats
+// and build the prefix index. Touches no readline state.
+void stage_history() {
+    int fd = open(HISTORY_FILE.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            staged.map = static_cast<const char*>(map);
+            staged.size = st.st_size;
+        }
+    }
+    if (fd >= 0) close(fd);
+    std::string_view data(staged.map, staged.size);
+    std::string_view stamp;
+    for (size_t pos = 0; pos < data.size();) {
+        size_t nl = data.find('\n', pos);
+        if (nl == std::string_view::npos) nl = data.size();
+        std::string_view l = data.substr(pos, nl - pos);
+        pos = nl + 1;
+        if (is_timestamp(l)) {
+            stamp = l;
+            continue;
+        }
+        if (l.empty()) continue;
+        staged.entries.push_back({l, stamp});
+        stamp = {};
+    }
+    stats_owner = getpid();
+    if (!load_stats_file()) {
+        stats_from_history();
+        save_stats();
+    }
+    std::vector<std::string_view> lines;
+    lines.reserve(staged.entries.size());
+    for (const auto& e : staged.entries) lines.push_back(e.first);
+    reindex(lines);
+}
+
+// Main thread only, like all of readline.
+void apply_staged() {
+    std::string line, stamp;
+    for (const auto& e : staged.entries) {
+        line.assign(e.first);
+        add_history(line.c_str());
+        if (e.second.empty()) continue;
+        stamp.assign(e.second);
+        add_history_time(stamp.c_str());
+    }
+    if (staged.map) munmap(const_cast<char*>(staged.map), staged.size);
+    staged = Staged();
+    // A line readline already started has its place in history at the old end
+    using_history();
+}
+
+} // namespace
 
 void load_history_file() {
-    read_history(HISTORY_FILE.c_str());
+    stage_history();
+    apply_staged();
+    std::atexit(save_stats);
+}
+
+void load_history_file_async() {
+    // Handlers run in reverse: the load is finished before the stats are saved
+    std::atexit(save_stats);
+    std::atexit(history_wait);
+    // Signals stay with the main thread: a SIGCHLD taken by the loader
+    // would never wake a wait_child() in sigsuspend
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    loader = std::thread(stage_history);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+void history_wait() {
+    if (!loader.joinable()) return;
+    loader.join();
+    apply_staged();
+}
+
+void history_append(const std::string& line, bool persist) {
+    history_wait();
+    // A command repeated back to back is logged once; its stats still count it
+    HIST_ENTRY* last = history_length > 0 ? history_get(history_base + history_length - 1) : nullptr;
+    bool repeat = last && line == last->line;
+    uint64_t h = command_hash(line);
+    uint32_t now = time(nullptr);
+    uint64_t cwd = cwd_hash();
+    record_use(stats, h, now, cwd);
+    if (!repeat) add_history(line.c_str());
+    index_line(line);
+    if (!persist) return;
+    if (!repeat) append_history_record(line);
+    record_use(session, h, now, cwd);
+    if (++unsaved_uses >= STATS_SAVE_EVERY) save_stats();
+}
+
+void history_cwd_changed() {
+    history_wait();
+    cwd_known = false;
+}
+
+void history_reindex() {
+    history_wait();
+    std::vector<std::string_view> lines;
+    HIST_ENTRY** hist = history_list();
+    for (int i = 0; hist && i < history_length; ++i) lines.push_back(hist[i]->line);
+    reindex(lines);
 }
 
-void save_history_file() {
-    write_history(HISTORY_FILE.c_str());
+std::string_view history_find_prefix(std::string_view prefix, size_t max_extra) {
+    history_wait();
+    if (prefix.empty()) return {};
+    size_t lo = lower_pos(prefix);
+    size_t hi = std::partition_point(idx.order.begin() + lo, idx.order.end(),
+                                     [&](uint32_t id) {
+                                         return std::string_view(idx.lines[id]).substr(0, prefix.size()) == prefix;
+                                     }) -
+                idx.order.begin();
+    // The exact line, if present, sorts first in the range; never suggest it.
+    if (lo < hi && text_at(lo).size() == prefix.size()) ++lo;
+    if (lo >= hi) return {};
+
+    // Highest frecency wins; ties (and lines with no stats) go to the most recent
+    const uint32_t now = time(nullptr);
+    const uint64_t cwd = cwd_hash();
+    size_t best = hi;
+    uint64_t best_score = 0, best_stamp = 0;
+    auto consider = [&](size_t pos) {
+        const Slot& slot = idx.slots[pos];
+        if (text_at(pos).size() - prefix.size() > max_extra) return;
+        uint64_t score = frecency({0, slot.cwd, slot.count, slot.last_used}, now, cwd);
+        if (score > best_score || (score == best_score && slot.stamp > best_stamp)) {
+            best_score = score;
+            best_stamp = slot.stamp;
+            best = pos;
+        }
+    };
+    auto scan = [&](size_t from, size_t to) {
+        for (size_t pos = std::max(from, lo); pos < std::min(to, hi); ++pos) consider(pos);
+    };
+    auto may_win = [&](size_t b) {
+        const BlockMax& m = idx.blocks[b];
+        uint64_t bound = frecency_bound(m.count, m.last_used, now);
+        return bound > best_score || (bound == best_score && m.stamp > best_stamp);
+    };
+    size_t first = lo / BLOCK, last = (hi - 1) / BLOCK;
+    // Seed with the block that could score highest (or, without stats,
+    // holds the newest line), then skip every block whose bound can't beat
+    // the best so far
+    size_t seed = first;
+    uint64_t seed_bound = 0, seed_stamp = 0;
+    for (size_t b = first; b <= last; ++b) {
+        uint64_t bound = frecency_bound(idx.blocks[b].count, idx.blocks[b].last_used, now);
+        if (bound > seed_bound || (bound == seed_bound && idx.blocks[b].stamp > seed_stamp)) {
+            seed_bound = bound;
+            seed_stamp = idx.blocks[b].stamp;
+            seed = b;
+        }
+    }
+    scan(seed * BLOCK, (seed + 1) * BLOCK);
+    for (size_t b = first; b <= last; ++b) {
+        if (b != seed && may_win(b)) scan(b * BLOCK, (b + 1) * BLOCK);
+    }
+    return best == hi ? std::string_view() : text_at(best);
 }
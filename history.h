@@ -1,7 +1,33 @@
 #ifndef GOONSH_HISTORY_H
 #define GOONSH_HISTORY_H
 
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Load ~/.dgsh_history (read in one pass) into readline and the prefix
+// index, and the usage statistics from the ~/.dgsh_history.stats sidecar.
 void load_history_file();
-void save_history_file();
+// The same, except that the reading, the stats and the index are done by a
+// thread of its own while the shell gets on with starting up. Readline's
+// history stays empty until history_wait() hands it the lines, on the
+// calling thread; every function below waits first.
+void load_history_file_async();
+void history_wait();
+
+// Record a use of `line`: readline's history and the prefix index get it
+// (once, if it repeats the previous line) and so do its usage statistics,
+// with the time and the current directory. Unless `persist` is false it
+// is also appended to ~/.dgsh_history and counted in the stats file.
+void history_append(const std::string& line, bool persist = true);
+// The shell changed directory (`cd`); suggestions follow the new one.
+void history_cwd_changed();
+// Rebuild the prefix index from readline's history list (after bulk loads).
+void history_reindex();
+// Best history line that starts with `prefix` and is longer than it by at
+// most `max_extra` chars, or an empty view: highest frecency (see
+// histstats.h), which favors commands run often, lately and in the current
+// directory; the most recent one among equals. Does not allocate.
+std::string_view history_find_prefix(std::string_view prefix, size_t max_extra);
 
 #endif // GOONSH_HISTORY_H
@@ -0,0 +1,127 @@
+#include "histstats.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const char STATS_MAGIC[8] = {'D', 'G', 'S', 'H', 'S', 'T', 'A', '1'};
+const size_t MIN_CAPACITY = 64;
+
+struct StatsHeader {
+    char magic[8];
+    uint64_t capacity;
+    uint64_t used;
+};
+
+uint32_t recency_weight(uint32_t last_used, uint32_t now) {
+    uint32_t age = now > last_used ? now - last_used : 0;
+    if (age < 3600) return 16;
+    if (age < 86400) return 8;
+    if (age < 7 * 86400) return 2;
+    return 1;
+}
+
+} // namespace
+
+uint64_t command_hash(std::string_view text) {
+    // FNV-1a, then a final mix so the low bits (the table index) are good
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : text) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h ? h : 1;
+}
+
+const CommandStats* StatsTable::find(uint64_t hash) const {
+    if (table.empty()) return nullptr;
+    size_t mask = table.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        if (table[i].hash == hash) return &table[i];
+        if (table[i].hash == 0) return nullptr;
+    }
+}
+
+CommandStats& StatsTable::upsert(uint64_t hash) {
+    // Grow at 70% full so probe runs stay short
+    if ((used + 1) * 10 > table.size() * 7) rehash(std::max(MIN_CAPACITY, table.size() * 2));
+    size_t mask = table.size() - 1;
+    size_t i = hash & mask;
+    for (; table[i].hash != 0; i = (i + 1) & mask) {
+        if (table[i].hash == hash) return table[i];
+    }
+    ++used;
+    table[i] = {hash, 0, 0, 0};
+    return table[i];
+}
+
+void StatsTable::rehash(size_t capacity) {
+    std::vector<CommandStats> old(capacity, CommandStats{});
+    old.swap(table);
+    size_t mask = capacity - 1;
+    for (const auto& s : old) {
+        if (s.hash == 0) continue;
+        size_t i = s.hash & mask;
+        while (table[i].hash != 0) i = (i + 1) & mask;
+        table[i] = s;
+    }
+}
+
+void StatsTable::trim(size_t keep) {
+    if (used <= keep) return;
+    std::vector<CommandStats> live;
+    live.reserve(used);
+    for (const auto& s : table)
+        if (s.hash != 0) live.push_back(s);
+    std::nth_element(live.begin(), live.begin() + keep, live.end(),
+                     [](const CommandStats& a, const CommandStats& b) { return a.last_used > b.last_used; });
+    live.resize(keep);
+    size_t capacity = MIN_CAPACITY;
+    while (keep * 10 > capacity * 7) capacity *= 2;
+    table.assign(capacity, CommandStats{});
+    used = 0;
+    for (const auto& s : live) upsert(s.hash) = s;
+}
+
+std::string StatsTable::serialize() const {
+    StatsHeader header;
+    memcpy(header.magic, STATS_MAGIC, sizeof(header.magic));
+    header.capacity = table.size();
+    header.used = used;
+    std::string out(sizeof(header) + table.size() * sizeof(CommandStats), '\0');
+    memcpy(&out[0], &header, sizeof(header));
+    if (!table.empty()) memcpy(&out[sizeof(header)], table.data(), table.size() * sizeof(CommandStats));
+    return out;
+}
+
+bool StatsTable::deserialize(std::string_view data) {
+    StatsHeader header;
+    if (data.size() < sizeof(header)) return false;
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, STATS_MAGIC, sizeof(header.magic)) != 0) return false;
+    size_t capacity = header.capacity;
+    if (capacity > data.size() || (capacity & (capacity - 1)) != 0 || header.used * 10 > capacity * 7 ||
+        data.size() != sizeof(header) + capacity * sizeof(CommandStats))
+        return false;
+    std::vector<CommandStats> slots(capacity);
+    if (capacity) memcpy(slots.data(), data.data() + sizeof(header), capacity * sizeof(CommandStats));
+    // `used` must be what the slots hold: with no empty slot left, find()
+    // and upsert() would probe forever
+    size_t live = std::count_if(slots.begin(), slots.end(), [](const CommandStats& s) { return s.hash != 0; });
+    if (live != header.used) return false;
+    table.swap(slots);
+    used = header.used;
+    return true;
+}
+
+uint64_t frecency(const CommandStats& stats, uint32_t now, uint64_t cwd) {
+    uint64_t score = static_cast<uint64_t>(stats.count) * recency_weight(stats.last_used, now);
+    return stats.cwd == cwd ? score * 2 : score;
+}
+
+uint64_t frecency_bound(uint32_t max_count, uint32_t newest, uint32_t now) {
+    return static_cast<uint64_t>(max_count) * recency_weight(newest, now) * 2;
+}
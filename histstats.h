@@ -0,0 +1,56 @@
+#ifndef GOONSH_HISTSTATS_H
+#define GOONSH_HISTSTATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Usage statistics behind history suggestions: for every unique command
+// line, how often it ran, when it last ran and in which directory. Lines
+// are identified by a 64-bit hash, so an entry is 24 bytes whatever the
+// command's length.
+
+struct CommandStats {
+    uint64_t hash;       // command_hash() of the line; 0 marks an empty slot
+    uint64_t cwd;        // command_hash() of the directory it last ran in
+    uint32_t count;
+    uint32_t last_used;  // epoch seconds
+};
+
+uint64_t command_hash(std::string_view text);
+
+// Open-addressing table (linear probing, power-of-two capacity) of
+// CommandStats keyed by hash. Its slot array is also the on-disk format,
+// so loading one is a single read with no rehashing.
+class StatsTable {
+public:
+    const CommandStats* find(uint64_t hash) const;
+    // The entry for `hash`, added with zero counts if it's new. The
+    // reference is valid until the next upsert.
+    CommandStats& upsert(uint64_t hash);
+    size_t size() const { return used; }
+    const std::vector<CommandStats>& slots() const { return table; }
+    // Keep only the `keep` most recently used entries.
+    void trim(size_t keep);
+
+    // Serialized form: magic, capacity, used count, then the slots.
+    std::string serialize() const;
+    bool deserialize(std::string_view data);
+
+private:
+    std::vector<CommandStats> table;
+    size_t used = 0;
+    void rehash(size_t capacity);
+};
+
+// Frecency of one command: its use count weighted by how recently it last
+// ran (x16 within the hour, x8 within the day, x2 within the week, else
+// x1), doubled when it last ran in the current directory.
+uint64_t frecency(const CommandStats& stats, uint32_t now, uint64_t cwd);
+// The highest frecency any command used at most `max_count` times and
+// last used no later than `newest` can have.
+uint64_t frecency_bound(uint32_t max_count, uint32_t newest, uint32_t now);
+
+#endif // GOONSH_HISTSTATS_H
@@ -0,0 +1,345 @@
+#include "jobs.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// Statuses reaped by the handler, waiting for the main thread. The handler
+// is the only writer of `head` and the main thread (with SIGCHLD blocked)
+// the only writer of `tail`. When the ring is full the handler stops
+// reaping; jobs_update() collects the rest itself.
+struct Reaped {
+    pid_t pid;
+    int status;
+    struct rusage usage;
+};
+constexpr unsigned RING_SIZE = 256;
+Reaped ring[RING_SIZE];
+std::atomic<unsigned> ring_head{0};
+std::atomic<unsigned> ring_tail{0};
+static_assert(std::atomic<unsigned>::is_always_lock_free, "ring indices must be signal safe");
+
+std::vector<std::unique_ptr<Job>> jobs;  // oldest first; back() is the current job
+std::map<pid_t, int> unclaimed;          // exit statuses of children outside any job
+bool handler_installed = false;
+bool shell_has_terminal = false;
+struct termios shell_tmodes;
+
+constexpr int WAIT_FLAGS = WNOHANG | WUNTRACED | WCONTINUED;
+
+void sigchld_handler(int) {
+    int saved_errno = errno;
+    for (;;) {
+        unsigned head = ring_head.load(std::memory_order_relaxed);
+        if (head - ring_tail.load(std::memory_order_acquire) >= RING_SIZE) break;
+        Reaped& r = ring[head % RING_SIZE];
+        pid_t pid = wait4(-1, &r.status, WAIT_FLAGS, &r.usage);
+        if (pid <= 0) break;
+        r.pid = pid;
+        ring_head.store(head + 1, std::memory_order_release);
+    }
+    errno = saved_errno;
+}
+
+void install_handler() {
+    struct sigaction sa;
+    sa.sa_handler = sigchld_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &sa, nullptr);
+    handler_installed = true;
+}
+
+void record_status(pid_t pid, int status, const struct rusage& usage) {
+    for (auto& job : jobs) {
+        for (auto& p : job->procs) {
+            if (p.pid != pid) continue;
+            p.status = status;
+            if (WIFSTOPPED(status)) {
+                p.stopped = true;
+            } else if (WIFCONTINUED(status)) {
+                p.stopped = false;
+            } else {
+                p.exited = true;
+                p.stopped = false;
+                p.usage = usage;
+            }
+            return;
+        }
+    }
+    if (WIFEXITED(status) || WIFSIGNALED(status)) unclaimed[pid] = status;
+}
+
+// Caller has SIGCHLD blocked. `sweep` also collects children the handler
+// left behind.
+void drain(bool sweep = false) {
+    unsigned tail = ring_tail.load(std::memory_order_relaxed);
+    unsigned head = ring_head.load(std::memory_order_acquire);
+    bool was_full = head - tail >= RING_SIZE;
+    for (; tail != head; ++tail) {
+        const Reaped& r = ring[tail % RING_SIZE];
+        record_status(r.pid, r.status, r.usage);
+    }
+    ring_tail.store(tail, std::memory_order_release);
+    if (!was_full && !sweep) return;
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, WAIT_FLAGS, &usage)) > 0) record_status(pid, status, usage);
+}
+
+int status_code(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status)) return 128 + WSTOPSIG(status);
+    return 0;
+}
+
+std::string state_text(const Job& job) {
+    if (job.stopped()) return "Stopped";
+    if (!job.done()) return "Running";
+    const auto& last = job.procs.back();
+    if (WIFSIGNALED(last.status)) return strsignal(WTERMSIG(last.status));
+    int code = job.status();
+    return code == 0 ? "Done" : "Exit " + std::to_string(code);
+}
+
+char job_mark(const Job& job) {
+    if (!jobs.empty() && jobs.back().get() == &job) return '+';
+    if (jobs.size() > 1 && jobs[jobs.size() - 2].get() == &job) return '-';
+    return ' ';
+}
+
+void print_job(const Job& job, bool long_format) {
+    std::string state = state_text(job);
+    std::cout << "[" << job.id << "]" << job_mark(job) << "  ";
+    if (long_format) std::cout << job.pgid << " ";
+    std::cout << state << std::string(state.size() < 24 ? 24 - state.size() : 1, ' ') << job.command;
+    if (job.background && !job.done() && !job.stopped()) std::cout << " &";
+    std::cout << std::endl;
+}
+
+// Make `job` the current one (%+).
+void make_current(Job* job) {
+    auto it = std::find_if(jobs.begin(), jobs.end(), [&](const auto& j) { return j.get() == job; });
+    if (it != jobs.end()) std::rotate(it, it + 1, jobs.end());
+}
+
+void remove_job(Job* job) {
+    jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [&](const auto& j) { return j.get() == job; }),
+               jobs.end());
+}
+
+} // namespace
+
+bool Job::done() const {
+    return std::all_of(procs.begin(), procs.end(), [](const JobProcess& p) { return p.exited; });
+}
+
+bool Job::stopped() const {
+    bool any_stopped = false;
+    for (const auto& p : procs) {
+        if (!p.exited && !p.stopped) return false;
+        any_stopped |= p.stopped;
+    }
+    return any_stopped;
+}
+
+int Job::status() const {
+    if (last_failed) return last_failed;
+    return procs.empty() ? 0 : status_code(procs.back().status);
+}
+
+void jobs_init() {
+    install_handler();
+    shell_has_terminal = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &shell_tmodes) == 0;
+}
+
+void jobs_forget() {
+    jobs.clear();
+    unclaimed.clear();
+    ring_tail = ring_head.load();
+}
+
+Job* job_add(pid_t pgid, const std::vector<pid_t>& pids, const std::string& command, bool background,
+             int last_failed) {
+    // Benchmarks and other embedders launch without jobs_init()
+    bool late_install = !handler_installed;
+    if (late_install) install_handler();
+    ChildSignalBlock block;
+    auto job = std::make_unique<Job>();
+    job->id = jobs.empty() ? 1 : std::max_element(jobs.begin(), jobs.end(), [](const auto& a, const auto& b) {
+                                     return a->id < b->id;
+                                 })->get()->id + 1;
+    job->pgid = pgid;
+    job->command = command;
+    job->background = background;
+    job->last_failed = last_failed;
+    for (pid_t pid : pids) job->procs.push_back({pid});
+    jobs.push_back(std::move(job));
+    // Children that exited before the handler existed raised no signal
+    if (late_install) drain(true);
+    return jobs.back().get();
+}
+
+void jobs_update() {
+    ChildSignalBlock block;
+    drain();
+}
+
+int job_wait(Job* job, bool terminal, struct rusage* usage) {
+    {
+        TraceSpan span("wait");
+        ChildSignalBlock block;
+        for (drain(); !job->done() && !job->stopped(); drain()) block.suspend();
+    }
+    if (usage) {
+        *usage = {};
+        for (const auto& p : job->procs) {
+            timeradd(&usage->ru_utime, &p.usage.ru_utime, &usage->ru_utime);
+            timeradd(&usage->ru_stime, &p.usage.ru_stime, &usage->ru_stime);
+            usage->ru_maxrss = std::max(usage->ru_maxrss, p.usage.ru_maxrss);
+        }
+    }
+    if (terminal) {
+        if (job->stopped()) job->has_tmodes = tcgetattr(STDIN_FILENO, &job->tmodes) == 0;
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+        if (shell_has_terminal) tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+    }
+    if (job->stopped()) {
+        int code = 0;
+        for (const auto& p : job->procs)
+            if (p.stopped) code = status_code(p.status);
+        job->background = true;
+        job->stop_reported = true;
+        make_current(job);
+        if (shell_has_terminal) {
+            std::cout << std::endl;
+            print_job(*job, false);
+        }
+        return code;
+    }
+    int code = job->status();
+    remove_job(job);
+    return code;
+}
+
+void jobs_notify(bool print) {
+    ChildSignalBlock block;
+    drain();
+    // The shell owns the terminal again; remember its modes for after the next job
+    if (shell_has_terminal) tcgetattr(STDIN_FILENO, &shell_tmodes);
+    for (auto& job : jobs) {
+        if (job->stopped() && !job->stop_reported) {
+            job->stop_reported = true;
+            if (print) print_job(*job, false);
+        } else if (job->done() && print) {
+            print_job(*job, false);
+        }
+    }
+    jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [](const auto& j) { return j->done(); }), jobs.end());
+    if (unclaimed.size() > 1024) unclaimed.clear();
+}
+
+Job* job_find(const std::string& spec, const char* who) {
+    jobs_update();
+    Job* found = nullptr;
+    if (spec.empty() || spec == "%%" || spec == "%+" || spec == "%") {
+        if (!jobs.empty()) found = jobs.back().get();
+    } else if (spec == "%-") {
+        if (jobs.size() > 1) found = jobs[jobs.size() - 2].get();
+    } else if (spec[0] == '%' && isdigit(static_cast<unsigned char>(spec[1]))) {
+        int id = atoi(spec.c_str() + 1);
+        for (auto& j : jobs)
+            if (j->id == id) found = j.get();
+    } else if (spec[0] == '%') {
+        std::string prefix = spec.substr(1);
+        for (auto& j : jobs)
+            if (j->command.compare(0, prefix.size(), prefix) == 0) found = j.get();
+    } else if (isdigit(static_cast<unsigned char>(spec[0]))) {
+        pid_t pid = atoi(spec.c_str());
+        for (auto& j : jobs)
+            for (auto& p : j->procs)
+                if (p.pid == pid) found = j.get();
+    }
+    if (!found) std::cerr << who << ": " << (spec.empty() ? "current" : spec) << ": no such job" << std::endl;
+    return found;
+}
+
+int job_foreground(Job* job) {
+    std::cout << job->command << std::endl;
+    if (shell_has_terminal) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+        if (job->has_tmodes) tcsetattr(STDIN_FILENO, TCSADRAIN, &job->tmodes);
+    }
+    {
+        ChildSignalBlock block;
+        for (auto& p : job->procs) p.stopped = false;
+        job->background = false;
+        job->stop_reported = false;
+    }
+    make_current(job);
+    kill(-job->pgid, SIGCONT);
+    return job_wait(job, shell_has_terminal);
+}
+
+int job_background(Job* job) {
+    {
+        ChildSignalBlock block;
+        for (auto& p : job->procs) p.stopped = false;
+        job->background = true;
+        job->stop_reported = false;
+    }
+    make_current(job);
+    kill(-job->pgid, SIGCONT);
+    std::cout << "[" << job->id << "]" << job_mark(*job) << " " << job->command << " &" << std::endl;
+    return 0;
+}
+
+int jobs_wait_all() {
+    int code = 0;
+    for (;;) {
+        jobs_update();
+        auto it = std::find_if(jobs.begin(), jobs.end(), [](const auto& j) { return !j->stopped(); });
+        if (it == jobs.end()) return code;
+        code = job_wait(it->get(), false);
+    }
+}
+
+void jobs_list(bool pids_only, bool long_format) {
+    jobs_update();
+    for (auto& job : jobs) {
+        if (pids_only) std::cout << job->pgid << std::endl;
+        else print_job(*job, long_format);
+    }
+}
+
+int wait_child(pid_t pid) {
+    // sigsuspend() below only wakes up for a caught signal
+    if (!handler_installed) install_handler();
+    ChildSignalBlock block;
+    for (;;) {
+        drain();
+        auto it = unclaimed.find(pid);
+        if (it != unclaimed.end()) {
+            int status = it->second;
+            unclaimed.erase(it);
+            return status;
+        }
+        // With SIGCHLD blocked nobody else can reap it, so ECHILD is final
+        int status;
+        pid_t r = waitpid(pid, &status, WNOHANG);
+        if (r == pid) return status;
+        if (r < 0 && errno != EINTR) return -1;
+        block.suspend();
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef GOONSH_JOBS_H
+#define GOONSH_JOBS_H
+
+#include <csignal>
+#include <string>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <termios.h>
+#include <vector>
+
+// Job table. Every pipeline the shell launches becomes a job: one process
+// group, one entry per stage. A SIGCHLD handler reaps children as they
+// change state (exit, stop, continue) and queues the raw wait statuses; the
+// main thread folds them into the table whenever it looks at it. Nothing
+// polls, and no child stays a zombie longer than it takes the signal to
+// arrive.
+
+struct JobProcess {
+    pid_t pid;
+    int status = 0;  // last raw wait status
+    bool exited = false;
+    bool stopped = false;
+    struct rusage usage = {};  // from wait4(), once it has exited
+};
+
+struct Job {
+    int id;  // the n in %n
+    pid_t pgid;
+    std::string command;
+    std::vector<JobProcess> procs;
+    bool background;
+    int last_failed = 0;  // status of a last stage that never started
+    bool stop_reported = false;
+    bool has_tmodes = false;
+    struct termios tmodes;  // terminal modes saved when the job stopped
+
+    bool done() const;
+    bool stopped() const;  // nothing running, at least one stage stopped
+    // Exit status of the pipeline: its last stage, 128+N if killed by signal N.
+    int status() const;
+};
+
+// Holds SIGCHLD for a scope: while the table (or a half-launched pipeline,
+// whose group leader must stay unreaped) is being touched.
+struct ChildSignalBlock {
+    sigset_t old;
+    ChildSignalBlock() {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &set, &old);
+    }
+    ~ChildSignalBlock() { sigprocmask(SIG_SETMASK, &old, nullptr); }
+    // Sleep until a signal handler has run.
+    void suspend() { sigsuspend(&old); }
+};
+
+// Install the SIGCHLD handler. Call once, before anything is spawned.
+void jobs_init();
+
+// In a forked copy of the shell: drop the jobs, which are the parent's
+// children and not ours to wait for.
+void jobs_forget();
+
+// Register a launched pipeline; `pids` in stage order.
+Job* job_add(pid_t pgid, const std::vector<pid_t>& pids, const std::string& command, bool background,
+             int last_failed);
+// Fold queued child status changes into the table.
+void jobs_update();
+// Block until `job` finishes or stops. With `terminal`, the job owns the
+// terminal while it runs and the shell takes it back afterwards. Finished
+// jobs are dropped from the table. Returns the job's exit status; `usage`
+// gets the CPU time of its stages summed and the largest max RSS.
+int job_wait(Job* job, bool terminal, struct rusage* usage = nullptr);
+// Report finished and newly stopped background jobs (interactive shells
+// only) and drop the finished ones. Called before each prompt.
+void jobs_notify(bool print);
+
+// `%n`, `%%`, `%+`, `%-`, `%prefix` or a pid; nullptr (with a message) if
+// there is no such job. An empty spec means the current job.
+Job* job_find(const std::string& spec, const char* who);
+// Continue a stopped job in the foreground or background.
+int job_foreground(Job* job);
+int job_background(Job* job);
+// Wait for every job (`wait` with no arguments).
+int jobs_wait_all();
+// Print the table in `jobs` format.
+void jobs_list(bool pids_only, bool long_format);
+
+// Wait for a child that isn't part of any job (command substitution and
+// friends). Returns its raw wait status, or -1 if it isn't our child.
+int wait_child(pid_t pid);
+
+#endif // GOONSH_JOBS_H
@@ -0,0 +1,316 @@
+#include "parallel.h"
+#include "builtins.h"
+#include "exec.h"
+#include "jobs.h"
+#include "parser.h"
+#include "script.h"
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+volatile sig_atomic_t interrupted = 0;
+
+void on_interrupt(int) {
+    interrupted = 1;
+}
+
+// One item's job, from launch until its output and status are written out.
+struct Task {
+    size_t index;  // position in the input
+    std::string command;
+    Job* job = nullptr;
+    int out = -1;  // read ends of its output pipes (ordered mode only)
+    int err = -1;
+    std::string out_buf;
+    std::string err_buf;
+    bool finished = false;
+    int status = 0;
+    Clock::time_point start;
+    double seconds = 0;
+};
+
+struct Run {
+    const ParallelOptions& options;
+    std::deque<Task> tasks;  // input order; the front is the next to write out
+    size_t running = 0;
+    size_t total = 0;
+    size_t failed = 0;
+    int devnull = -1;
+    bool killed = false;
+};
+
+std::string quote(const std::string& item) {
+    std::string q = "'";
+    for (char c : item) {
+        if (c == '\'') q += "'\\''";
+        else q += c;
+    }
+    q += '\'';
+    return q;
+}
+
+void report(const Run& run, const Task& t) {
+    if (t.status == 0 && !run.options.verbose) return;
+    char secs[32];
+    snprintf(secs, sizeof(secs), "%.2fs", t.seconds);
+    std::cerr << "parallel: [" << t.index + 1 << "] exit " << t.status << " (" << secs << "): " << t.command
+              << std::endl;
+}
+
+void complete(Run& run, Task& t, int status) {
+    t.finished = true;
+    t.status = status;
+    t.seconds = std::chrono::duration<double>(Clock::now() - t.start).count();
+    if (status != 0) ++run.failed;
+    // Without ordering there is nothing to wait for before reporting
+    if (!run.options.ordered) report(run, t);
+}
+
+void close_fd(int& fd) {
+    if (fd == -1) return;
+    close(fd);
+    fd = -1;
+}
+
+// A command line that is more than one pipeline runs in a forked copy of
+// the shell, in a process group of its own like any other job (unless
+// exec_job_groups is off).
+Job* start_subshell(const std::shared_ptr<Script>& script, const std::string& command, int in, int out, int err) {
+    ChildSignalBlock hold;
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (exec_job_groups) setpgid(0, 0);
+        for (int sig : {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU}) signal(sig, SIG_DFL);
+        sigprocmask(SIG_SETMASK, &hold.old, nullptr);
+        if (in != -1) dup2(in, STDIN_FILENO);
+        if (out != -1) dup2(out, STDOUT_FILENO);
+        if (err != -1) dup2(err, STDERR_FILENO);
+        int status = script_run(script);
+        std::cout.flush();
+        _exit(status);
+    }
+    if (pid < 0) {
+        perror("parallel: fork");
+        return nullptr;
+    }
+    if (exec_job_groups) setpgid(pid, pid);
+    return job_add(exec_job_groups ? pid : getpgrp(), {pid}, command, true, 0);
+}
+
+// Launch the task's job; false if it finished on the spot (nothing to
+// run, or it failed to start).
+bool launch(Run& run, Task& t) {
+    t.start = Clock::now();
+    auto script = script_parse(t.command, "");
+    if (!script || !script->root) {
+        complete(run, t, script ? 0 : 2);
+        return false;
+    }
+    std::vector<CmdSegment> segments;
+    if (script_is_simple(*script) && !script->root->pipeline->timed) {
+        segments = lower_pipeline(*script->root->pipeline);
+        // Builtins run inside a shell process: give them one of their own
+        auto builtin = [](const CmdSegment& seg) { return !seg.args.empty() && find_builtin(seg.args[0]); };
+        if (std::any_of(segments.begin(), segments.end(), builtin)) segments.clear();
+        auto no_lines = [](std::string&) { return false; };
+        if (!segments.empty() && !collect_heredocs(segments, no_lines)) {
+            complete(run, t, 1);
+            return false;
+        }
+    }
+    int out[2] = {-1, -1}, err[2] = {-1, -1};
+    if (run.options.ordered) {
+        if (pipe2(out, O_CLOEXEC) != 0 || pipe2(err, O_CLOEXEC) != 0) {
+            perror("parallel: pipe");
+            for (int fd : {out[0], out[1], err[0], err[1]})
+                if (fd != -1) close(fd);
+            complete(run, t, 1);
+            return false;
+        }
+        // The shell side never blocks: it reads whatever poll says is there
+        fcntl(out[0], F_SETFL, O_NONBLOCK);
+        fcntl(err[0], F_SETFL, O_NONBLOCK);
+    }
+    int status = 1;
+    // Anything buffered would be written again by a forked copy
+    std::cout.flush();
+    t.job = segments.empty() ? start_subshell(script, t.command, run.devnull, out[1], err[1])
+                             : start_pipeline(segments, run.devnull, out[1], err[1], status);
+    close_fd(out[1]);
+    close_fd(err[1]);
+    t.out = out[0];
+    t.err = err[0];
+    if (!t.job) {
+        close_fd(t.out);
+        close_fd(t.err);
+        complete(run, t, status);
+        return false;
+    }
+    return true;
+}
+
+// Read what is waiting on one of a task's pipes, straight through to our
+// own stream if the task is at the front, else into its buffer.
+void read_pipe(int& fd, std::string& buf, std::ostream& stream, bool front) {
+    char chunk[64 * 1024];
+    while (fd != -1) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n > 0) {
+            if (front) stream.write(chunk, n);
+            else buf.append(chunk, n);
+        } else if (n == 0 || errno != EINTR) {
+            if (n == 0 || errno != EAGAIN) close_fd(fd);
+            break;
+        }
+    }
+    if (front) stream.flush();
+}
+
+// Block until a job exits, output arrives or ^C, then collect it all.
+void wait_for_progress(Run& run) {
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigaddset(&block, SIGINT);
+    sigprocmask(SIG_BLOCK, &block, &old);
+    jobs_update();
+    bool ready = interrupted;
+    std::vector<struct pollfd> fds;
+    for (const auto& t : run.tasks) {
+        if (!t.job) continue;
+        if (t.job->done()) ready = true;
+        if (t.out != -1) fds.push_back({t.out, POLLIN, 0});
+        if (t.err != -1) fds.push_back({t.err, POLLIN, 0});
+    }
+    // A SIGCHLD or SIGINT that came in since the check above is still
+    // pending, and interrupts ppoll as soon as it unblocks them
+    if (!ready) ppoll(fds.data(), fds.size(), nullptr, &old);
+    sigprocmask(SIG_SETMASK, &old, nullptr);
+
+    if (interrupted && !run.killed) {
+        run.killed = true;
+        // Tasks in our own group got the SIGINT already
+        for (const auto& t : run.tasks)
+            if (t.job && t.job->pgid != getpgrp()) kill(-t.job->pgid, SIGINT);
+    }
+    jobs_update();
+    for (auto& t : run.tasks) {
+        if (!t.job) continue;
+        bool front = run.options.ordered && &t == &run.tasks.front();
+        read_pipe(t.out, t.out_buf, std::cout, front);
+        read_pipe(t.err, t.err_buf, std::cerr, front);
+        if (!t.job->done()) continue;
+        // Exited: whatever is left in the pipes is there now. A descendant
+        // still holding them open doesn't keep the task alive.
+        close_fd(t.out);
+        close_fd(t.err);
+        int status = job_wait(t.job, false);
+        t.job = nullptr;
+        --run.running;
+        complete(run, t, status);
+    }
+}
+
+// Write out finished tasks from the front, and whatever the new front
+// buffered while it waited its turn.
+void flush_front(Run& run) {
+    while (!run.tasks.empty()) {
+        Task& t = run.tasks.front();
+        if (!t.out_buf.empty()) {
+            std::cout << t.out_buf << std::flush;
+            std::string().swap(t.out_buf);
+        }
+        if (!t.err_buf.empty()) {
+            std::cerr << t.err_buf << std::flush;
+            std::string().swap(t.err_buf);
+        }
+        if (!t.finished) break;
+        if (run.options.ordered) report(run, t);
+        run.tasks.pop_front();
+    }
+}
+
+} // namespace
+
+std::string parallel_command(const std::vector<std::string>& command, const std::string& item) {
+    std::string line;
+    bool placed = false;
+    for (const auto& word : command) {
+        if (!line.empty()) line += ' ';
+        for (size_t i = 0; i < word.size(); ++i) {
+            if (word.compare(i, 2, "{}") == 0) {
+                line += quote(item);
+                placed = true;
+                ++i;
+            } else {
+                line += word[i];
+            }
+        }
+    }
+    if (!placed) {
+        line += ' ';
+        line += quote(item);
+    }
+    return line;
+}
+
+int parallel_run(const std::vector<std::string>& command, const std::function<bool(std::string&)>& next_item,
+                 const ParallelOptions& options) {
+    TraceSpan span("parallel");
+    Run run{options};
+    run.devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    interrupted = 0;
+    struct sigaction on_int, old_int;
+    on_int.sa_handler = on_interrupt;
+    sigemptyset(&on_int.sa_mask);
+    on_int.sa_flags = 0;
+    sigaction(SIGINT, &on_int, &old_int);
+    std::cout.flush();
+
+    auto begin = Clock::now();
+    bool more = true;
+    std::string item;
+    for (;;) {
+        while (more && !interrupted && run.running < options.jobs) {
+            if (!next_item(item)) {
+                more = false;
+                break;
+            }
+            run.tasks.push_back({});
+            Task& t = run.tasks.back();
+            t.index = run.total++;
+            t.command = parallel_command(command, item);
+            if (launch(run, t)) ++run.running;
+        }
+        flush_front(run);
+        if (run.running == 0 && (!more || interrupted)) break;
+        if (run.running > 0) wait_for_progress(run);
+    }
+    flush_front(run);
+
+    sigaction(SIGINT, &old_int, nullptr);
+    if (run.devnull != -1) close(run.devnull);
+    if (options.verbose) {
+        double secs = std::chrono::duration<double>(Clock::now() - begin).count();
+        char line[128];
+        snprintf(line, sizeof(line), "parallel: %zu jobs, %zu failed, %.2fs, %.1f jobs/s", run.total, run.failed,
+                 secs, secs > 0 ? run.total / secs : 0.0);
+        std::cerr << line << std::endl;
+    }
+    if (interrupted) return 130;
+    return run.failed > 100 ? 101 : static_cast<int>(run.failed);
+}
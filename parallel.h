@@ -0,0 +1,33 @@
+#ifndef GOONSH_PARALLEL_H
+#define GOONSH_PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Engine of the `parallel` builtin: run one command line per input item
+// with up to N jobs in flight. A line that is one pipeline of external
+// commands goes through the same launch path as every other (see exec.h);
+// builtins, lists and control flow run in a forked copy of the shell.
+// Either way it is a job with its own process group and stdin on
+// /dev/null. The shell waits on all of them at once: one ppoll() over
+// their output pipes that SIGCHLD also wakes up.
+
+struct ParallelOptions {
+    size_t jobs = 1;       // jobs in flight at most
+    bool ordered = true;   // each job's output whole and in input order; else jobs write straight to ours
+    bool verbose = false;  // report every job and the overall throughput, not just failures
+};
+
+// Command line for one item: `command` words joined by spaces, with each
+// {} replaced by the item, single-quoted; with no {} the item goes last.
+std::string parallel_command(const std::vector<std::string>& command, const std::string& item);
+
+// Run `command` once per item from `next_item` (which returns false when
+// there are none left). Returns 0 if every job succeeded, else the number
+// of failed jobs (101 for more than 100), or 130 after ^C.
+int parallel_run(const std::vector<std::string>& command, const std::function<bool(std::string&)>& next_item,
+                 const ParallelOptions& options);
+
+#endif // GOONSH_PARALLEL_H
@@ -0,0 +1,407 @@
+#include "parser.h"
+#include "expand.h"
+#include "pathglob.h"
+#include "trace.h"
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static bool is_operator_char(char c) {
+    return c == '|' || c == '&' || c == '<' || c == '>' || c == ';' || c == '\n';
+}
+
+// A $(...) or `...` starting at src[i] is one unit, wherever its blanks,
+// quotes and operators fall. Returns the index of its last character (the
+// end of input if it is unterminated, noted in `open`), or i if src[i]
+// starts neither.
+static size_t skip_substitution(std::string_view src, size_t i, uint8_t& open) {
+    size_t close = std::string_view::npos;
+    if (src[i] == '`') close = find_backquote_close(src, i + 1);
+    else if (i + 1 < src.size() && src[i + 1] == '(') close = find_subst_close(src, i + 2);
+    else return i;
+    if (close != std::string_view::npos) return close;
+    open |= LEX_OPEN_QUOTE;
+    return src.size() - 1;
+}
+
+// Body of the heredoc whose lines start at `from`: everything up to the
+// line equal to `delim` (or to end of input, noted in `open`). `resume`
+// gets the offset just past the delimiter line.
+static std::string_view heredoc_body(std::string_view src, size_t from, std::string_view delim, size_t& resume,
+                                     uint8_t& open) {
+    for (size_t line = from; line < src.size();) {
+        size_t eol = src.find('\n', line);
+        size_t end = eol == std::string_view::npos ? src.size() : eol;
+        if (src.substr(line, end - line) == delim) {
+            resume = eol == std::string_view::npos ? src.size() : eol + 1;
+            return src.substr(from, line - from);
+        }
+        line = end + 1;
+    }
+    resume = src.size();
+    open |= LEX_OPEN_HEREDOC;
+    return src.substr(std::min(from, src.size()));
+}
+
+void lex_line(std::string_view src, std::vector<Token>& out, uint8_t* open_end) {
+    out.clear();
+    uint8_t open = 0;
+    size_t n = src.size();
+    size_t i = 0;
+    size_t resume = std::string_view::npos;  // past this line's heredoc bodies
+    while (i < n) {
+        char c = src[i];
+        if (is_blank(c)) {
+            ++i;
+            continue;
+        }
+        if (c == '#') {
+            size_t eol = src.find('\n', i);
+            if (eol == std::string_view::npos) break;
+            i = eol;
+            continue;
+        }
+        if (is_operator_char(c)) {
+            TokKind kind = TokKind::Pipe;
+            size_t len = 1;
+            if (c == '&') kind = TokKind::Amp;
+            else if (c == '<') kind = TokKind::Less;
+            else if (c == '>') kind = TokKind::Great;
+            else if (c == ';') kind = TokKind::Semi;
+            else if (c == '\n') kind = TokKind::Newline;
+            char next = i + 1 < n ? src[i + 1] : '\0';
+            if ((c == '<' || c == '>' || c == '&' || c == '|') && next == c) {
+                kind = c == '<' ? TokKind::DLess : c == '>' ? TokKind::DGreat : c == '&' ? TokKind::AndIf : TokKind::OrIf;
+                len = 2;
+                if (c == '<' && i + 2 < n && src[i + 2] == '<') {
+                    kind = TokKind::TLess;
+                    len = 3;
+                }
+            } else if ((c == '<' || c == '>') && next == '&') {
+                kind = c == '<' ? TokKind::LessAnd : TokKind::GreatAnd;
+                len = 2;
+            } else if (c == '&' && next == '>') {
+                bool append = i + 2 < n && src[i + 2] == '>';
+                kind = append ? TokKind::AndDGreat : TokKind::AndGreat;
+                len = append ? 3 : 2;
+            }
+            out.push_back({kind, 0, src.substr(i, len)});
+            i += len;
+            if (kind == TokKind::Newline && resume != std::string_view::npos) {
+                i = resume;
+                resume = std::string_view::npos;
+            }
+            continue;
+        }
+        size_t start = i;
+        uint8_t flags = 0;
+        while (i < n) {
+            c = src[i];
+            if (c == '\\') {
+                flags |= TOK_ESCAPED;
+                i += 2;
+            } else if (c == '\'') {
+                flags |= TOK_SQUOTED;
+                size_t close = src.find('\'', i + 1);
+                if (close == std::string_view::npos) open |= LEX_OPEN_QUOTE;
+                i = close == std::string_view::npos ? n : close + 1;
+            } else if (c == '"') {
+                flags |= TOK_DQUOTED;
+                for (++i; i < n && src[i] != '"'; ++i) {
+                    if (src[i] == '\\') {
+                        ++i;
+                    } else if (src[i] == '$' || src[i] == '`') {
+                        flags |= TOK_DOLLAR;
+                        i = skip_substitution(src, i, open);
+                    }
+                }
+                if (i >= n) open |= LEX_OPEN_QUOTE;
+                ++i;
+            } else if (c == '`') {
+                flags |= TOK_DOLLAR;
+                i = skip_substitution(src, i, open) + 1;
+            } else if (c == '$') {
+                flags |= TOK_DOLLAR;
+                ++i;
+                if (i < n && src[i] == '(') {
+                    i = skip_substitution(src, i - 1, open) + 1;
+                } else if (i < n && src[i] == '{') {
+                    // ${...} is one unit, so ${X:-a b} doesn't split at the blank
+                    for (int depth = 0; i < n; ++i) {
+                        if (src[i] == '\\') ++i;
+                        else if (src[i] == '{') ++depth;
+                        else if (src[i] == '}' && --depth == 0) break;
+                    }
+                    if (i >= n) open |= LEX_OPEN_QUOTE;
+                    ++i;
+                }
+            } else if (is_blank(c) || is_operator_char(c)) {
+                break;
+            } else {
+                if (c == '*' || c == '?' || c == '[' || c == '{') flags |= TOK_GLOB;
+                ++i;
+            }
+        }
+        if (i > n) i = n;
+        std::string_view text = src.substr(start, i - start);
+        if (flags == 0 && i < n && (src[i] == '<' || src[i] == '>') && text.size() <= 4 &&
+            text.find_first_not_of("0123456789") == std::string_view::npos) {
+            out.push_back({TokKind::IoNumber, 0, text});
+            continue;
+        }
+        out.push_back({TokKind::Word, flags, text});
+        if (out.size() < 2 || out[out.size() - 2].kind != TokKind::DLess) continue;
+        // A heredoc delimiter: its body starts on the next line, after any
+        // earlier heredoc bodies of this line
+        size_t eol = src.find('\n', i);
+        if (eol == std::string_view::npos) {
+            open |= LEX_OPEN_HEREDOC;
+            continue;
+        }
+        std::string delim = word_value({out.back().text, flags});
+        std::string_view body = heredoc_body(src, resume == std::string_view::npos ? eol + 1 : resume, delim, resume, open);
+        out.push_back({TokKind::HeredocBody, 0, body});
+    }
+    if (open_end) *open_end = open;
+}
+
+static bool is_list_op(TokKind k) {
+    return k == TokKind::Semi || k == TokKind::AndIf || k == TokKind::OrIf || k == TokKind::Newline;
+}
+
+bool is_redir_op(TokKind k) {
+    switch (k) {
+    case TokKind::Less:
+    case TokKind::Great:
+    case TokKind::DGreat:
+    case TokKind::DLess:
+    case TokKind::TLess:
+    case TokKind::LessAnd:
+    case TokKind::GreatAnd:
+    case TokKind::AndGreat:
+    case TokKind::AndDGreat: return true;
+    default: return false;
+    }
+}
+
+static RedirKind redir_kind(TokKind k) {
+    switch (k) {
+    case TokKind::Less: return RedirKind::In;
+    case TokKind::Great: return RedirKind::Out;
+    case TokKind::DGreat: return RedirKind::Append;
+    case TokKind::TLess: return RedirKind::HereString;
+    case TokKind::LessAnd: return RedirKind::DupIn;
+    case TokKind::GreatAnd: return RedirKind::DupOut;
+    case TokKind::AndGreat: return RedirKind::OutErr;
+    case TokKind::AndDGreat: return RedirKind::AppendErr;
+    default: return RedirKind::Heredoc;
+    }
+}
+
+// Descriptor a redirection sets when no IoNumber names one.
+static int default_fd(RedirKind kind) {
+    switch (kind) {
+    case RedirKind::In:
+    case RedirKind::Heredoc:
+    case RedirKind::HereString:
+    case RedirKind::DupIn: return 0;
+    default: return 1;
+    }
+}
+
+const Pipeline* Parser::parse(std::string_view src) {
+    lex_line(src, tokens);
+    size_t n = 0;
+    while (n < tokens.size() && !is_list_op(tokens[n].kind)) ++n;
+    if (n == 0) return nullptr;
+    arena.reset();
+    return build_pipeline(tokens.data(), n, arena);
+}
+
+const Pipeline* build_pipeline(const Token* tokens, size_t ntokens, Arena& arena) {
+    // Size every array up front so each node is allocated exactly once.
+    uint32_t ncmds = 1;
+    for (size_t i = 0; i < ntokens; ++i) {
+        if (tokens[i].kind == TokKind::Pipe) ++ncmds;
+    }
+    Pipeline* p = arena.alloc<Pipeline>(1);
+    Command* cmds = arena.alloc<Command>(ncmds);
+    p->cmds = cmds;
+    p->ncmds = 0;
+
+    size_t i = 0;
+    // `time` is a reserved word only as written: "time" or $t run a command
+    if (ntokens > 0 && tokens[0].kind == TokKind::Word && tokens[0].flags == 0 && tokens[0].text == "time") {
+        p->timed = true;
+        i = 1;
+    }
+    while (i <= ntokens) {
+        size_t end = i;
+        uint32_t nwords = 0, nredirs = 0;
+        for (; end < ntokens && tokens[end].kind != TokKind::Pipe; ++end) {
+            TokKind k = tokens[end].kind;
+            if (is_redir_op(k)) {
+                ++nredirs;
+                if (end + 1 < ntokens && tokens[end + 1].kind == TokKind::Word) ++end;
+            } else if (k == TokKind::Word) {
+                ++nwords;
+            }
+        }
+        Command& cmd = cmds[p->ncmds];
+        Word* words = arena.alloc<Word>(nwords);
+        Redir* redirs = arena.alloc<Redir>(nredirs);
+        cmd = {words, 0, redirs, 0};
+        for (size_t j = i; j < end; ++j) {
+            const Token& t = tokens[j];
+            if (t.kind == TokKind::Word) {
+                words[cmd.nwords++] = {t.text, t.flags};
+            } else if (t.kind == TokKind::Amp) {
+                p->background = true;
+            } else if (is_redir_op(t.kind)) {
+                Redir& r = redirs[cmd.nredirs++];
+                r.kind = redir_kind(t.kind);
+                r.fd = default_fd(r.kind);
+                if (j > i && tokens[j - 1].kind == TokKind::IoNumber) {
+                    r.fd = 0;
+                    for (char d : tokens[j - 1].text) r.fd = r.fd * 10 + (d - '0');
+                }
+                r.target = {};
+                if (j + 1 < end && tokens[j + 1].kind == TokKind::Word) {
+                    ++j;
+                    r.target = {tokens[j].text, tokens[j].flags};
+                }
+                if (j + 1 < end && tokens[j + 1].kind == TokKind::HeredocBody) r.body = tokens[++j].text;
+            }
+            // Newlines after a trailing "|" just continue the pipeline
+        }
+        // A trailing "|" with nothing after it doesn't start a new stage.
+        if (cmd.nwords || cmd.nredirs || p->ncmds == 0) ++p->ncmds;
+        i = end + 1;
+    }
+    return p;
+}
+
+std::string word_value(const Word& w) {
+    if (!(w.flags & (TOK_SQUOTED | TOK_DQUOTED | TOK_ESCAPED))) return std::string(w.raw);
+    std::string out;
+    out.reserve(w.raw.size());
+    std::string_view s = w.raw;
+    size_t n = s.size();
+    for (size_t i = 0; i < n; ++i) {
+        char c = s[i];
+        if (c == '\\') {
+            out += i + 1 < n ? s[++i] : '\\';
+        } else if (c == '\'') {
+            for (++i; i < n && s[i] != '\''; ++i) out += s[i];
+        } else if (c == '"') {
+            for (++i; i < n && s[i] != '"'; ++i) {
+                // Inside double quotes a backslash only escapes $ ` " and itself.
+                if (s[i] == '\\' && i + 1 < n &&
+                    (s[i + 1] == '$' || s[i + 1] == '`' || s[i + 1] == '"' || s[i + 1] == '\\'))
+                    ++i;
+                out += s[i];
+            }
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+std::string expanded_value(const Word& w) {
+    if (!(w.flags & (TOK_SQUOTED | TOK_DQUOTED | TOK_ESCAPED | TOK_DOLLAR)) && w.raw[0] != '~')
+        return std::string(w.raw);
+    return expand_word(w.raw);
+}
+
+// Is the word one unquoted $(...) or `...` and nothing else?
+static bool is_bare_substitution(const Word& w) {
+    std::string_view s = w.raw;
+    if (w.flags != TOK_DOLLAR || s.size() < 2) return false;
+    if (s[0] == '`') return find_backquote_close(s, 1) == s.size() - 1;
+    return s.size() > 2 && s[0] == '$' && s[1] == '(' && find_subst_close(s, 2) == s.size() - 1;
+}
+
+void expand_word_fields(const Word& w, std::vector<std::string>& argv) {
+    if (is_bare_substitution(w)) {
+        // As in zsh, the one expansion that is split into words: at blanks
+        // and newlines, and with nothing left for empty output
+        std::string value = expand_word(w.raw);
+        size_t i = 0;
+        while (i < value.size()) {
+            size_t start = value.find_first_not_of(" \t\n", i);
+            if (start == std::string::npos) break;
+            i = value.find_first_of(" \t\n", start);
+            if (i == std::string::npos) i = value.size();
+            argv.emplace_back(value, start, i - start);
+        }
+        return;
+    }
+    if (!(w.flags & TOK_GLOB)) {
+        argv.push_back(expanded_value(w));
+        return;
+    }
+    std::string pattern;
+    expand_pattern_into(w.raw, pattern);
+    glob_word(pattern, argv);
+}
+
+CursorContext cursor_context(std::string_view line, size_t point) {
+    static thread_local std::vector<Token> toks;
+    if (point > line.size()) point = line.size();
+    std::string_view before = line.substr(0, point);
+    lex_line(before, toks);
+    size_t word_start = point;
+    size_t prev = toks.size();
+    // If the cursor touches the end of a word, that word is being completed.
+    if (!toks.empty() && toks.back().kind == TokKind::Word &&
+        toks.back().text.data() + toks.back().text.size() == before.data() + before.size()) {
+        word_start = toks.back().text.data() - line.data();
+        prev = toks.size() - 1;
+    }
+    bool command_position = prev == 0 || toks[prev - 1].kind == TokKind::Pipe ||
+                            toks[prev - 1].kind == TokKind::Amp || is_list_op(toks[prev - 1].kind);
+    return {command_position, word_start};
+}
+
+std::vector<CmdSegment> lower_pipeline(const Pipeline& pipeline) {
+    std::vector<CmdSegment> segments(pipeline.ncmds);
+    for (uint32_t i = 0; i < pipeline.ncmds; ++i) {
+        const Command& cmd = pipeline.cmds[i];
+        CmdSegment& seg = segments[i];
+        seg.args.reserve(cmd.nwords);
+        for (uint32_t j = 0; j < cmd.nwords; ++j) expand_word_fields(cmd.words[j], seg.args);
+        seg.redirs.reserve(cmd.nredirs);
+        for (uint32_t j = 0; j < cmd.nredirs; ++j) {
+            const Redir& r = cmd.redirs[j];
+            if (r.target.raw.empty()) continue;
+            FdRedir f{r.kind, r.fd, {}, r.body};
+            // The delimiter is matched literally, never expanded
+            f.target = r.kind == RedirKind::Heredoc ? word_value(r.target) : expanded_value(r.target);
+            // `>& file` is csh's &>: only a number or - names a descriptor
+            if (r.kind == RedirKind::DupOut && r.fd == 1 && f.target != "-" &&
+                f.target.find_first_not_of("0123456789") != std::string::npos)
+                f.kind = RedirKind::OutErr;
+            seg.redirs.push_back(std::move(f));
+        }
+    }
+    if (!segments.empty()) segments.back().background = pipeline.background;
+    return segments;
+}
+
+std::vector<CmdSegment> parse_pipeline(const std::string& line) {
+    static Parser parser;
+    const Pipeline* p;
+    {
+        TraceSpan span("parse");
+        p = parser.parse(line);
+    }
+    if (!p) return {};
+    TraceSpan span("expand");
+    return lower_pipeline(*p);
+}
@@ -0,0 +1,163 @@
+#ifndef GOONSH_PARSER_H
+#define GOONSH_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "arena.h"
+
+// Single-pass lexer and parser shared by the interactive loop, scripts,
+// ~/.dgshrc and completion. Tokens are views into the source line with
+// quoting metadata attached; the AST is built in an arena that is rewound
+// on every parse, so a warmed-up Parser doesn't allocate per line.
+
+enum class TokKind : uint8_t {
+    Word,
+    Pipe,     // |
+    Amp,      // &
+    Less,     // <
+    Great,    // >
+    DGreat,   // >>
+    DLess,    // <<
+    TLess,    // <<<
+    LessAnd,  // <&
+    GreatAnd, // >&
+    AndGreat, // &>
+    AndDGreat,  // &>>
+    Semi,     // ;
+    AndIf,    // &&
+    OrIf,     // ||
+    Newline,  // only in multi-line sources (scripts)
+    HeredocBody,  // follows a << delimiter whose body is in the source
+    IoNumber,     // the digits of 2> or 0<&3, written right against the operator
+};
+
+// Is `k` a redirection operator (it takes the next word as its target)?
+bool is_redir_op(TokKind k);
+
+// Word flags: quoting and expansions that appear in the raw text.
+enum : uint8_t {
+    TOK_SQUOTED = 1 << 0,
+    TOK_DQUOTED = 1 << 1,
+    TOK_ESCAPED = 1 << 2,
+    TOK_DOLLAR = 1 << 3,  // has a $ or ` outside single quotes
+    TOK_GLOB = 1 << 4,    // has an unquoted * ? [ or {
+};
+
+struct Token {
+    TokKind kind;
+    uint8_t flags;
+    std::string_view text;  // raw source text, quotes included
+};
+
+// What lex_line() can report as left open at the end of its input
+enum : uint8_t {
+    LEX_OPEN_QUOTE = 1 << 0,    // a quote, $(...), `...` or ${...}
+    LEX_OPEN_HEREDOC = 1 << 1,  // a heredoc body without its delimiter line
+};
+
+// Split `src` into tokens (`out` is cleared first). An unquoted '#' at the
+// start of a word runs to the end of the line. A word of digits that runs
+// into a < or > is an IoNumber, so `2>&1` is three tokens and no `&`.
+// Unterminated quotes run to end of input. When the source continues past
+// a line holding `<< DELIM`, the body lines are emitted as one HeredocBody
+// token right after DELIM and lexing resumes after the delimiter line.
+// With `open` non-null it is set to the LEX_OPEN_* constructs that ran to
+// end of input.
+void lex_line(std::string_view src, std::vector<Token>& out, uint8_t* open = nullptr);
+
+struct Word {
+    std::string_view raw;
+    uint8_t flags;
+};
+
+enum class RedirKind : uint8_t {
+    In,         // <
+    Out,        // >
+    Append,     // >>
+    Heredoc,    // <<
+    HereString, // <<<
+    DupIn,      // <&
+    DupOut,     // >&
+    OutErr,     // &>, and >& with a file name
+    AppendErr,  // &>>
+};
+
+struct Redir {
+    RedirKind kind;
+    int fd;  // the descriptor it sets: the IoNumber, else 0 or 1 by operator
+    Word target;
+    std::string_view body;  // heredoc text from the source, if it had one
+};
+
+struct Command {
+    const Word* words;
+    uint32_t nwords;
+    const Redir* redirs;
+    uint32_t nredirs;
+};
+
+struct Pipeline {
+    const Command* cmds;
+    uint32_t ncmds;
+    bool background;
+    bool timed;  // led by the reserved word `time` (unquoted, unexpanded), not in cmds
+};
+
+// Build one pipeline from `n` tokens holding no list operators (; && ||).
+// The tree is allocated in `arena` and points into the tokens' source.
+const Pipeline* build_pipeline(const Token* tokens, size_t n, Arena& arena);
+
+class Parser {
+public:
+    // Parse the first pipeline of a line, up to any ; && || or newline.
+    // Returns nullptr if it holds no tokens (blank or comment-only). The
+    // tree points into `src` and into this parser, so it is valid until the
+    // next parse() and while `src` is alive. Whole scripts go through
+    // script.h instead.
+    const Pipeline* parse(std::string_view src);
+
+private:
+    Arena arena;
+    std::vector<Token> tokens;
+};
+
+// Literal value of a word after quote removal, without expansion.
+std::string word_value(const Word& w);
+// Value of a word after expansion and quote removal.
+std::string expanded_value(const Word& w);
+// Append the fields a command word expands to: one, or with TOK_GLOB the
+// brace expansion and pathname matches of the word.
+void expand_word_fields(const Word& w, std::vector<std::string>& argv);
+
+// Where the cursor sits in a partially typed line, for completion.
+struct CursorContext {
+    bool command_position;  // the word at the cursor names a command
+    size_t word_start;      // offset where the word under the cursor begins
+};
+CursorContext cursor_context(std::string_view line, size_t point);
+
+// One redirection of a pipeline stage, expanded. A stage's redirections
+// apply in order, after its pipes: `>f 2>&1` sends both to f, `2>&1 >f`
+// only stdout.
+struct FdRedir {
+    RedirKind kind;
+    int fd;              // the descriptor it sets (&> and &>> set 1, then 2)
+    std::string target;  // path, fd number to copy (or "-" to close), << delimiter or <<< text
+    std::string_view body;  // << body given in the source (scripts), else read by collect_heredocs
+    int file = -1;       // << or <<< body, filled in by collect_heredocs
+};
+
+// Runtime form of one pipeline stage, consumed by run_pipeline.
+struct CmdSegment {
+    std::vector<std::string> args;
+    std::vector<FdRedir> redirs;
+    bool background = false;
+};
+
+std::vector<CmdSegment> lower_pipeline(const Pipeline& pipeline);
+std::vector<CmdSegment> parse_pipeline(const std::string& line);
+
+#endif // GOONSH_PARSER_H
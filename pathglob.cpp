@@ -0,0 +1,334 @@
+#include "pathglob.h"
+#include "trace.h"
+#include <algorithm>
+#include <condition_variable>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// Threads for a ** walk; directory reads are mostly waiting on the kernel,
+// so a few are enough to keep a cold tree busy.
+const unsigned MAX_WALK_THREADS = 4;
+
+std::string unescape(std::string_view s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '\\' && i + 1 < s.size()) ++i;
+        out += s[i];
+    }
+    return out;
+}
+
+// Match one character against the bracket expression at pattern[p] == '['.
+// Returns false if it isn't closed (then '[' is an ordinary character);
+// otherwise `matched` says whether `c` is in the set and `end` is just past
+// the closing ']'.
+bool match_bracket(std::string_view pattern, size_t p, char c, size_t& end, bool& matched) {
+    size_t i = p + 1;
+    bool negate = i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+    if (negate) ++i;
+    bool found = false;
+    for (bool first = true; i < pattern.size(); first = false) {
+        char lo = pattern[i];
+        if (lo == ']' && !first) {
+            end = i + 1;
+            matched = found != negate;
+            return true;
+        }
+        if (lo == '\\' && i + 1 < pattern.size()) lo = pattern[++i];
+        ++i;
+        char hi = lo;
+        if (i + 1 < pattern.size() && pattern[i] == '-' && pattern[i + 1] != ']') {
+            hi = pattern[i + 1];
+            i += 2;
+            if (hi == '\\' && i < pattern.size()) hi = pattern[i++];
+        }
+        if (static_cast<unsigned char>(c) >= static_cast<unsigned char>(lo) &&
+            static_cast<unsigned char>(c) <= static_cast<unsigned char>(hi))
+            found = true;
+    }
+    return false;
+}
+
+// The first {...} holding a top-level comma becomes one word per
+// alternative, each expanded again for any braces left. Braces without a
+// comma or without a match stay as they are.
+void expand_braces(std::string_view w, std::vector<std::string>& out) {
+    for (size_t i = 0; i < w.size(); ++i) {
+        if (w[i] == '\\') {
+            ++i;
+            continue;
+        }
+        if (w[i] != '{') continue;
+        int depth = 0;
+        size_t close = std::string_view::npos;
+        std::vector<size_t> commas;
+        for (size_t j = i; j < w.size(); ++j) {
+            if (w[j] == '\\') ++j;
+            else if (w[j] == '{') ++depth;
+            else if (w[j] == '}' && --depth == 0) {
+                close = j;
+                break;
+            } else if (w[j] == ',' && depth == 1) commas.push_back(j);
+        }
+        if (close == std::string_view::npos || commas.empty()) continue;
+        commas.push_back(close);
+        std::string_view prefix = w.substr(0, i), suffix = w.substr(close + 1);
+        size_t start = i + 1;
+        for (size_t comma : commas) {
+            std::string alt;
+            alt.reserve(prefix.size() + (comma - start) + suffix.size());
+            alt.append(prefix).append(w.substr(start, comma - start)).append(suffix);
+            expand_braces(alt, out);
+            start = comma + 1;
+        }
+        return;
+    }
+    out.emplace_back(w);
+}
+
+std::string join(const std::string& dir, std::string_view name) {
+    std::string path;
+    path.reserve(dir.size() + 1 + name.size());
+    path = dir;
+    if (!path.empty() && path.back() != '/') path += '/';
+    path += name;
+    return path;
+}
+
+struct Task {
+    std::string path;  // directory to look in; "" is the cwd
+    size_t comp;       // component of the pattern to match there
+};
+
+struct Walk {
+    std::vector<std::string> comps;    // pattern components, escapes kept
+    std::vector<std::string> literal;  // unescaped, for components with no metacharacters
+    std::vector<bool> has_meta;
+    bool dirs_only = false;  // pattern ends in '/'
+    // Shared work queue for parallel walks
+    std::mutex mu;
+    std::condition_variable cv;
+    std::vector<Task> queue;
+    unsigned busy = 0;
+};
+
+bool is_dir_at(int dirfd, const char* name, unsigned char type, bool follow) {
+    if (type == DT_DIR) return true;
+    if (type != DT_UNKNOWN && (type != DT_LNK || !follow)) return false;
+    struct stat st;
+    return fstatat(dirfd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+void emit(const Walk& w, std::string path, bool is_dir, std::vector<std::string>& found) {
+    if (w.dirs_only) {
+        if (!is_dir) return;
+        path += '/';
+    }
+    found.push_back(std::move(path));
+}
+
+// Component `k` against one entry of the directory `dirfd` at `path`.
+void match_entry(const Walk& w, const std::string& path, size_t k, int dirfd, const char* name,
+                 unsigned char type, std::vector<std::string>& found, std::vector<Task>& next) {
+    std::string_view n = name;
+    if (w.has_meta[k]) {
+        // Only a pattern that starts with a dot matches hidden names
+        if (n[0] == '.' && w.comps[k][0] != '.' && w.comps[k].compare(0, 2, "\\.") != 0) return;
+        if (!glob_match(w.comps[k], n)) return;
+    } else if (n != w.literal[k]) {
+        return;
+    }
+    bool last = k + 1 == w.comps.size();
+    if (!last && !is_dir_at(dirfd, name, type, true)) return;
+    if (last) emit(w, join(path, n), !w.dirs_only || is_dir_at(dirfd, name, type, true), found);
+    else next.push_back({join(path, n), k + 1});
+}
+
+// One directory: match its entries against the task's component and queue
+// the subdirectories the rest of the pattern needs.
+void process(const Walk& w, const Task& t, std::vector<std::string>& found, std::vector<Task>& next) {
+    const size_t k = t.comp;
+    const bool last = k + 1 == w.comps.size();
+    if (!w.has_meta[k]) {
+        // Nothing to list: the name either exists or it doesn't
+        std::string child = join(t.path, w.literal[k]);
+        if (!last) {
+            next.push_back({std::move(child), k + 1});
+            return;
+        }
+        struct stat st;
+        if (lstat(child.c_str(), &st) != 0) return;
+        bool is_dir = S_ISDIR(st.st_mode) || (S_ISLNK(st.st_mode) && stat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+        emit(w, std::move(child), is_dir, found);
+        return;
+    }
+    int fd = open(t.path.empty() ? "." : t.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    const bool any_depth = w.comps[k] == "**";
+    alignas(struct dirent64) char buf[1 << 15];
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        for (long pos = 0; pos < n;) {
+            const auto* d = reinterpret_cast<const struct dirent64*>(buf + pos);
+            pos += d->d_reclen;
+            const char* name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            if (!any_depth) {
+                match_entry(w, t.path, k, fd, name, d->d_type, found, next);
+                continue;
+            }
+            // **: every visible subdirectory gets the same task, and this
+            // directory's entries go on to the next component right away,
+            // hidden ones too: `**/.gitignore` and `**/.*` decide for themselves
+            bool hidden = name[0] == '.';
+            if (!hidden && is_dir_at(fd, name, d->d_type, false)) next.push_back({join(t.path, name), k});
+            if (!last) match_entry(w, t.path, k + 1, fd, name, d->d_type, found, next);
+            else if (!hidden) emit(w, join(t.path, name), !w.dirs_only || is_dir_at(fd, name, d->d_type, true), found);
+        }
+    }
+    close(fd);
+}
+
+void worker(Walk& w, std::vector<std::string>& found) {
+    std::vector<Task> next;
+    std::unique_lock<std::mutex> lock(w.mu);
+    for (;;) {
+        w.cv.wait(lock, [&] { return !w.queue.empty() || w.busy == 0; });
+        // Nothing queued and nobody left to queue more: the walk is done
+        if (w.queue.empty()) break;
+        Task t = std::move(w.queue.back());
+        w.queue.pop_back();
+        ++w.busy;
+        lock.unlock();
+        process(w, t, found, next);
+        lock.lock();
+        --w.busy;
+        bool more = !next.empty();
+        for (auto& task : next) w.queue.push_back(std::move(task));
+        next.clear();
+        if (more || w.busy == 0) w.cv.notify_all();
+    }
+}
+
+void walk_parallel(Walk& w, Task root, std::vector<std::string>& out) {
+    unsigned nthreads = std::max(1u, std::min(MAX_WALK_THREADS, std::thread::hardware_concurrency()));
+    std::vector<std::vector<std::string>> found(nthreads);
+    w.queue.push_back(std::move(root));
+    // Signals stay with the main thread: the workers start with them blocked
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < nthreads; ++i) threads.emplace_back(worker, std::ref(w), std::ref(found[i]));
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    worker(w, found[0]);
+    for (auto& t : threads) t.join();
+    for (auto& f : found) std::move(f.begin(), f.end(), std::back_inserter(out));
+}
+
+} // namespace
+
+bool glob_match(std::string_view pattern, std::string_view name) {
+    size_t p = 0, n = 0;
+    size_t star = std::string_view::npos, star_n = 0;
+    while (n < name.size()) {
+        if (p < pattern.size()) {
+            char c = pattern[p];
+            if (c == '*') {
+                star = ++p;
+                star_n = n;
+                continue;
+            }
+            if (c == '?') {
+                ++p;
+                ++n;
+                continue;
+            }
+            size_t end;
+            bool matched;
+            if (c == '[' && match_bracket(pattern, p, name[n], end, matched)) {
+                if (matched) {
+                    p = end;
+                    ++n;
+                    continue;
+                }
+            } else {
+                if (c == '\\' && p + 1 < pattern.size()) c = pattern[++p];
+                if (c == name[n]) {
+                    ++p;
+                    ++n;
+                    continue;
+                }
+            }
+        }
+        // Mismatch: let the last * swallow one more character
+        if (star == std::string_view::npos) return false;
+        p = star;
+        n = ++star_n;
+    }
+    while (p < pattern.size() && pattern[p] == '*') ++p;
+    return p == pattern.size();
+}
+
+bool glob_has_meta(std::string_view pattern) {
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        char c = pattern[i];
+        if (c == '\\') ++i;
+        else if (c == '*' || c == '?') return true;
+        else if (c == '[' && pattern.find(']', i + 2) != std::string_view::npos) return true;
+    }
+    return false;
+}
+
+size_t glob_paths(std::string_view pattern, std::vector<std::string>& out) {
+    Walk w;
+    Task root{pattern.substr(0, 1) == "/" ? "/" : "", 0};
+    w.dirs_only = !pattern.empty() && pattern.back() == '/';
+    bool recursive = false;
+    for (size_t start = 0; start <= pattern.size();) {
+        size_t slash = pattern.find('/', start);
+        if (slash == std::string_view::npos) slash = pattern.size();
+        std::string_view comp = pattern.substr(start, slash - start);
+        start = slash + 1;
+        if (comp.empty() || (comp == "**" && !w.comps.empty() && w.comps.back() == "**")) continue;
+        recursive |= comp == "**";
+        w.comps.emplace_back(comp);
+        w.has_meta.push_back(glob_has_meta(comp));
+        w.literal.push_back(w.has_meta.back() ? std::string() : unescape(comp));
+    }
+    if (w.comps.empty()) return 0;
+    size_t before = out.size();
+    if (recursive) {
+        walk_parallel(w, std::move(root), out);
+    } else {
+        // Matches go straight into `out`; the stack holds directories only
+        std::vector<Task> stack{std::move(root)};
+        while (!stack.empty()) {
+            Task t = std::move(stack.back());
+            stack.pop_back();
+            process(w, t, out, stack);
+        }
+    }
+    std::sort(out.begin() + before, out.end());
+    return out.size() - before;
+}
+
+void glob_word(std::string_view pattern, std::vector<std::string>& argv) {
+    TraceSpan span("glob");
+    std::vector<std::string> words;
+    expand_braces(pattern, words);
+    for (const auto& word : words) {
+        if (glob_has_meta(word) && glob_paths(word, argv) > 0) continue;
+        argv.push_back(unescape(word));
+    }
+}
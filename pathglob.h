@@ -0,0 +1,31 @@
+#ifndef GOONSH_PATHGLOB_H
+#define GOONSH_PATHGLOB_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Brace expansion and pathname globbing for command words: {a,b}, then
+// * ? [...] ([!...] and [^...] negate) in each path component and ** for
+// any number of directories. Patterns come from expand_pattern_into, so a
+// backslash always means "match the next character literally". As in
+// bash, * and ? never match a leading dot, . and .. are never matched,
+// and ** doesn't descend into hidden directories or through symlinks.
+//
+// Directories are read with getdents64 and the d_type it returns, so only
+// symlinks and filesystems without d_type cost a stat. Walks through **
+// run on a small thread pool.
+
+// Append the words `pattern` expands to straight onto `argv`: each brace
+// alternative in order, and for each the matching paths sorted bytewise.
+// A glob that matches nothing is kept as written, minus the escapes.
+void glob_word(std::string_view pattern, std::vector<std::string>& argv);
+// Append the paths matching `pattern` to `out`, sorted; returns how many.
+size_t glob_paths(std::string_view pattern, std::vector<std::string>& out);
+// Does `name` match one path component pattern (no slashes)?
+bool glob_match(std::string_view pattern, std::string_view name);
+// Are there any unescaped glob metacharacters in `pattern`?
+bool glob_has_meta(std::string_view pattern);
+
+#endif // GOONSH_PATHGLOB_H
@@ -0,0 +1,260 @@
+#include "prompt.h"
+#include "jobs.h"
+#include <readline/readline.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <poll.h>
+#include <pwd.h>
+#include <spawn.h>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+extern char** environ;
+
+int prompt_wait_ms = 50;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// A slow segment still running after this long is killed.
+constexpr auto SLOW_SEGMENT_LIMIT = std::chrono::seconds(2);
+constexpr size_t SLOW_SEGMENT_MAX = 256;  // bytes of output kept
+
+struct SlowSegment {
+    std::string value;  // last complete output, shown until a newer one lands
+    std::string pending;
+    pid_t pid = -1;
+    int fd = -1;
+    Clock::time_point started;
+};
+
+std::unordered_map<std::string, SlowSegment> slow;
+const PromptTemplate* active = nullptr;  // template on screen, for redraws
+
+bool have_cwd = false;
+std::string cwd;
+
+const std::string& user_name() {
+    static const std::string name = [] {
+        struct passwd* pw = getpwuid(getuid());
+        return std::string(pw ? pw->pw_name : "?");
+    }();
+    return name;
+}
+
+const std::string& host_name() {
+    static const std::string name = [] {
+        char host[256] = "";
+        gethostname(host, sizeof(host) - 1);
+        return std::string(host);
+    }();
+    return name;
+}
+
+const std::string& current_dir() {
+    if (!have_cwd) {
+        char buf[PATH_MAX];
+        cwd = getcwd(buf, sizeof(buf)) ? buf : "";
+        have_cwd = true;
+    }
+    return cwd;
+}
+
+// `sh -c cmd` in its own process group, stdout to a non-blocking pipe.
+void start_segment(const std::string& cmd, SlowSegment& seg) {
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC | O_NONBLOCK) != 0) return;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    sigset_t defaults, mask;
+    sigfillset(&defaults);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+    const char* argv[] = {"sh", "-c", cmd.c_str(), nullptr};
+    pid_t pid;
+    int err = posix_spawn(&pid, "/bin/sh", &actions, &attr, const_cast<char**>(argv), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(pipefd[1]);
+    if (err) {
+        close(pipefd[0]);
+        return;
+    }
+    seg.pid = pid;
+    seg.fd = pipefd[0];
+    seg.pending.clear();
+    seg.started = Clock::now();
+}
+
+void finish_segment(SlowSegment& seg, bool killed) {
+    if (killed) kill(-seg.pid, SIGKILL);
+    close(seg.fd);
+    wait_child(seg.pid);
+    seg.pid = -1;
+    seg.fd = -1;
+    if (killed) return;
+    auto eol = seg.pending.find('\n');
+    seg.value = seg.pending.substr(0, eol);
+}
+
+// Read whatever the segment has written. Returns true once it is finished.
+bool pump_segment(SlowSegment& seg) {
+    char buf[512];
+    for (;;) {
+        ssize_t n = read(seg.fd, buf, sizeof(buf));
+        if (n > 0) {
+            if (seg.pending.size() < SLOW_SEGMENT_MAX)
+                seg.pending.append(buf, std::min<size_t>(n, SLOW_SEGMENT_MAX - seg.pending.size()));
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) {
+            if (Clock::now() - seg.started < SLOW_SEGMENT_LIMIT) return false;
+            finish_segment(seg, true);
+            return true;
+        }
+        finish_segment(seg, false);
+        return true;
+    }
+}
+
+// Collect finished segments, waiting up to `timeout_ms` for the first one.
+// Returns true if any value changed and whether some are still running.
+bool pump_all(int timeout_ms, bool& running) {
+    std::vector<struct pollfd> fds;
+    for (auto& entry : slow)
+        if (entry.second.fd != -1) fds.push_back({entry.second.fd, POLLIN, 0});
+    running = !fds.empty();
+    if (!running) return false;
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    bool changed = false;
+    for (;;) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        if (poll(fds.data(), fds.size(), left > 0 ? left : 0) < 0 && errno != EINTR) break;
+        running = false;
+        for (auto& entry : slow) {
+            SlowSegment& seg = entry.second;
+            if (seg.fd == -1) continue;
+            std::string before = seg.value;
+            if (pump_segment(seg)) changed |= seg.value != before;
+            else running = true;
+        }
+        if (!running || left <= 0) break;
+        fds.clear();
+        for (auto& entry : slow)
+            if (entry.second.fd != -1) fds.push_back({entry.second.fd, POLLIN, 0});
+    }
+    return changed;
+}
+
+std::string compose(const PromptTemplate& tmpl) {
+    std::string out;
+    for (const auto& seg : tmpl) {
+        switch (seg.kind) {
+        case PromptSegment::Literal: out += seg.text; break;
+        case PromptSegment::User: out += user_name(); break;
+        case PromptSegment::Host: out += host_name(); break;
+        case PromptSegment::Cwd: out += current_dir(); break;
+        case PromptSegment::Sigil: out += geteuid() == 0 ? "#" : "$ "; break;
+        case PromptSegment::Command: out += slow[seg.text].value; break;
+        }
+    }
+    return out;
+}
+
+// Readline calls this about ten times a second while it waits for a key.
+int redraw_hook() {
+    bool running;
+    if (pump_all(0, running) && active) {
+        std::string text = compose(*active);
+        rl_set_prompt(text.c_str());
+        // Back to column 0 and clear, then redraw prompt and input in place
+        fputs("\r\033[K", rl_outstream);
+        rl_on_new_line();
+        rl_redisplay();
+    }
+    if (!running) rl_event_hook = nullptr;
+    return 0;
+}
+
+} // namespace
+
+PromptTemplate prompt_compile(const std::string& ps1) {
+    PromptTemplate tmpl;
+    auto literal = [&](const std::string& s) {
+        if (tmpl.empty() || tmpl.back().kind != PromptSegment::Literal) tmpl.push_back({PromptSegment::Literal, ""});
+        tmpl.back().text += s;
+    };
+    for (size_t i = 0; i < ps1.size(); ++i) {
+        if (ps1[i] != '\\' || i + 1 == ps1.size()) {
+            literal(std::string(1, ps1[i]));
+            continue;
+        }
+        char c = ps1[++i];
+        switch (c) {
+        case 'u': tmpl.push_back({PromptSegment::User, ""}); break;
+        case 'h': tmpl.push_back({PromptSegment::Host, ""}); break;
+        case 'w': tmpl.push_back({PromptSegment::Cwd, ""}); break;
+        case '$': tmpl.push_back({PromptSegment::Sigil, ""}); break;
+        case 'g': tmpl.push_back({PromptSegment::Command, "git branch --show-current"}); break;
+        case '[': literal(std::string(1, RL_PROMPT_START_IGNORE)); break;
+        case ']': literal(std::string(1, RL_PROMPT_END_IGNORE)); break;
+        case 'e': literal("\033"); break;
+        case '\\': literal("\\"); break;
+        case '0': {
+            int code = 0;
+            size_t j = i;
+            for (; j < ps1.size() && j < i + 3 && ps1[j] >= '0' && ps1[j] <= '7'; ++j) code = code * 8 + (ps1[j] - '0');
+            i = j - 1;
+            literal(std::string(1, static_cast<char>(code)));
+            break;
+        }
+        case '(': {
+            // \(CMD): up to the matching ')'
+            size_t depth = 1, j = i + 1;
+            for (; j < ps1.size(); ++j) {
+                if (ps1[j] == '(') ++depth;
+                else if (ps1[j] == ')' && --depth == 0) break;
+            }
+            tmpl.push_back({PromptSegment::Command, ps1.substr(i + 1, j - i - 1)});
+            i = j;
+            break;
+        }
+        default: literal(std::string{'\\', c});
+        }
+    }
+    return tmpl;
+}
+
+std::string prompt_render(const PromptTemplate& tmpl) {
+    active = &tmpl;
+    for (const auto& seg : tmpl) {
+        if (seg.kind != PromptSegment::Command) continue;
+        SlowSegment& s = slow[seg.text];
+        if (s.fd == -1) start_segment(seg.text, s);
+    }
+    bool running;
+    pump_all(prompt_wait_ms, running);
+    rl_event_hook = running ? redraw_hook : nullptr;
+    return compose(tmpl);
+}
+
+void prompt_cwd_changed() {
+    have_cwd = false;
+}
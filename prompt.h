@@ -0,0 +1,33 @@
+#ifndef GOONSH_PROMPT_H
+#define GOONSH_PROMPT_H
+
+#include <string>
+#include <vector>
+
+// PS1 handling. The prompt string is compiled once into a segment list;
+// user, host and euid are looked up on first use and then cached, and the
+// working directory is only re-read after `cd`. Slow segments (`\g` for
+// the git branch, `\(CMD)` for the first line of CMD's output) run in the
+// background: the prompt waits at most prompt_wait_ms for them, shows the
+// previous value if they aren't done, and redraws once they finish.
+
+struct PromptSegment {
+    enum Kind { Literal, User, Host, Cwd, Sigil, Command };
+    Kind kind;
+    std::string text;  // literal text, or the command of a slow segment
+};
+
+using PromptTemplate = std::vector<PromptSegment>;
+
+// Escapes: \u \h \w \$ \[ \] \e \0NN \\ \g \(CMD). Unknown escapes are kept as-is.
+PromptTemplate prompt_compile(const std::string& ps1);
+// Render `tmpl`, starting its slow segments. While any are still running,
+// readline's event hook redraws the prompt as they complete.
+std::string prompt_render(const PromptTemplate& tmpl);
+// Called by `cd`: the next render re-reads the working directory.
+void prompt_cwd_changed();
+
+// Milliseconds a render waits for slow segments (`prompt_timeout=` in ~/.dgshrc).
+extern int prompt_wait_ms;
+
+#endif // GOONSH_PROMPT_H
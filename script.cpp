@@ -0,0 +1,904 @@
+#include "script.h"
+#include "alias.h"
+#include "builtins.h"
+#include "cat.h"
+#include "exec.h"
+#include "jobs.h"
+#include "shell.h"
+#include "subst.h"
+#include "trace.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+std::function<bool(std::string&)> script_heredoc_lines;
+
+namespace {
+
+bool is_name(std::string_view s) {
+    if (s.empty() || !(isalpha(static_cast<unsigned char>(s[0])) || s[0] == '_')) return false;
+    return std::all_of(s.begin(), s.end(), [](char c) { return isalnum(static_cast<unsigned char>(c)) || c == '_'; });
+}
+
+// --- Parser ---
+
+class ScriptParser {
+public:
+    ScriptParser(Script& script, const std::vector<Token>& tokens) : script(script), toks(tokens) {}
+
+    const Node* parse() {
+        Node* root = parse_list({});
+        if (!failed && pos < toks.size()) fail(&toks[pos]);
+        return failed ? nullptr : root;
+    }
+
+    bool failed = false;
+    bool hit_eof = false;        // failed because the source ended early
+    const Token* bad = nullptr;  // token the error is at
+
+private:
+    Script& script;
+    const std::vector<Token>& toks;
+    size_t pos = 0;
+
+    const Token* peek() const { return pos < toks.size() ? &toks[pos] : nullptr; }
+
+    // Keywords and function names must be written without quoting
+    static bool is_plain(const Token& t) { return t.kind == TokKind::Word && !(t.flags & ~TOK_GLOB); }
+
+    bool at_word(std::string_view kw) const {
+        const Token* t = peek();
+        return t && is_plain(*t) && t->text == kw;
+    }
+
+    bool at_any(std::initializer_list<std::string_view> kws) const {
+        return std::any_of(kws.begin(), kws.end(), [&](std::string_view kw) { return at_word(kw); });
+    }
+
+    bool at(TokKind kind) const { return pos < toks.size() && toks[pos].kind == kind; }
+
+    void skip_newlines() {
+        while (at(TokKind::Newline)) ++pos;
+    }
+
+    std::nullptr_t fail(const Token* t) {
+        if (failed) return nullptr;
+        failed = true;
+        bad = t;
+        hit_eof = t == nullptr;
+        return nullptr;
+    }
+
+    bool expect(std::string_view kw) {
+        if (at_word(kw)) {
+            ++pos;
+            return true;
+        }
+        fail(peek());
+        return false;
+    }
+
+    Node* node(NodeKind kind) {
+        Node* n = script.arena.alloc<Node>(1);
+        n->kind = kind;
+        return n;
+    }
+
+    // Commands up to one of `terminators` in command position (or the end).
+    Node* parse_list(std::initializer_list<std::string_view> terminators) {
+        std::vector<Node*> items;
+        for (;;) {
+            skip_newlines();
+            if (!peek()) {
+                if (terminators.size()) return fail(nullptr);
+                break;
+            }
+            if (at_any(terminators)) break;
+            Node* item = parse_and_or();
+            if (failed) return nullptr;
+            if (at(TokKind::Amp)) {
+                if (item->kind != NodeKind::Command) return fail(peek());
+                item->background = true;
+                ++pos;
+            } else if (at(TokKind::Semi) || at(TokKind::Newline)) {
+                ++pos;
+            } else if (peek() && !at_any(terminators)) {
+                return fail(peek());
+            }
+            items.push_back(item);
+        }
+        if (items.size() == 1) return items[0];
+        Node* list = node(NodeKind::List);
+        const Node** arr = script.arena.alloc<const Node*>(items.size());
+        std::copy(items.begin(), items.end(), arr);
+        list->items = arr;
+        list->nitems = items.size();
+        return list;
+    }
+
+    Node* parse_and_or() {
+        Node* left = parse_pipeline();
+        while (!failed && (at(TokKind::AndIf) || at(TokKind::OrIf))) {
+            NodeKind kind = at(TokKind::AndIf) ? NodeKind::And : NodeKind::Or;
+            ++pos;
+            skip_newlines();
+            Node* right = parse_pipeline();
+            if (failed) return nullptr;
+            Node* n = node(kind);
+            n->a = left;
+            n->b = right;
+            left = n;
+        }
+        return left;
+    }
+
+    Node* parse_pipeline() {
+        if (at_word("!")) {
+            ++pos;
+            Node* inner = parse_pipeline();
+            if (failed) return nullptr;
+            Node* n = node(NodeKind::Not);
+            n->a = inner;
+            return n;
+        }
+        return parse_command();
+    }
+
+    Node* parse_command() {
+        const Token* t = peek();
+        if (!t) return fail(nullptr);
+        Node* compound = nullptr;
+        if (at_word("if")) {
+            ++pos;
+            compound = parse_if();
+        } else if (at_word("while") || at_word("until")) {
+            compound = parse_loop();
+        } else if (at_word("for")) {
+            compound = parse_for();
+        } else if (at_word("{")) {
+            ++pos;
+            compound = parse_list({"}"});
+            if (!failed) expect("}");
+        } else if (at_word("function")) {
+            ++pos;
+            const Token* name = peek();
+            if (!name || name->kind != TokKind::Word) return fail(name);
+            ++pos;
+            if (at_word("()")) ++pos;
+            compound = parse_function(*name, name->text);
+        } else if (is_plain(*t) && t->text.size() > 2 &&
+                   t->text.substr(t->text.size() - 2) == "()") {
+            ++pos;
+            compound = parse_function(*t, t->text.substr(0, t->text.size() - 2));
+        } else if (is_plain(*t) && pos + 1 < toks.size() && is_plain(toks[pos + 1]) && toks[pos + 1].text == "()") {
+            pos += 2;
+            compound = parse_function(*t, t->text);
+        } else if (at_any({"then", "elif", "else", "fi", "do", "done", "}", "in"})) {
+            return fail(t);
+        } else {
+            return parse_simple();
+        }
+        if (failed) return nullptr;
+        // Compound commands can't be piped or redirected (yet)
+        if (at(TokKind::Pipe) || at(TokKind::IoNumber) || (peek() && is_redir_op(peek()->kind)) ||
+            (peek() && peek()->kind == TokKind::Word))
+            return fail(peek());
+        return compound;
+    }
+
+    Node* parse_simple() {
+        size_t end = pos;
+        for (; end < toks.size(); ++end) {
+            TokKind k = toks[end].kind;
+            if (k == TokKind::Semi || k == TokKind::AndIf || k == TokKind::OrIf || k == TokKind::Amp) break;
+            // A newline right after "|" continues the pipeline
+            if (k == TokKind::Newline && (end == pos || toks[end - 1].kind != TokKind::Pipe)) break;
+            if (k == TokKind::Newline) {
+                while (end + 1 < toks.size() && toks[end + 1].kind == TokKind::Newline) ++end;
+            }
+        }
+        size_t last = end;
+        while (last > pos && toks[last - 1].kind == TokKind::Newline) --last;
+        if (last == pos) return fail(peek());
+        if (toks[last - 1].kind == TokKind::Pipe) return fail(end < toks.size() ? &toks[end] : nullptr);
+        Node* n = node(NodeKind::Command);
+        n->pipeline = build_pipeline(&toks[pos], end - pos, script.arena);
+        pos = end;
+        return n;
+    }
+
+    // After `if` or `elif`; consumes the closing `fi`.
+    Node* parse_if() {
+        Node* n = node(NodeKind::If);
+        n->a = parse_list({"then"});
+        if (failed || !expect("then")) return nullptr;
+        n->b = parse_list({"elif", "else", "fi"});
+        if (failed) return nullptr;
+        if (at_word("elif")) {
+            ++pos;
+            n->c = parse_if();
+            return failed ? nullptr : n;
+        }
+        if (at_word("else")) {
+            ++pos;
+            n->c = parse_list({"fi"});
+            if (failed) return nullptr;
+        }
+        return expect("fi") ? n : nullptr;
+    }
+
+    Node* parse_loop() {
+        Node* n = node(at_word("while") ? NodeKind::While : NodeKind::Until);
+        ++pos;
+        n->a = parse_list({"do"});
+        if (failed || !expect("do")) return nullptr;
+        n->b = parse_list({"done"});
+        if (failed || !expect("done")) return nullptr;
+        return n;
+    }
+
+    Node* parse_for() {
+        ++pos;
+        const Token* name = peek();
+        if (!name || name->kind != TokKind::Word || !is_name(name->text)) return fail(name);
+        ++pos;
+        Node* n = node(NodeKind::For);
+        n->name = {name->text, name->flags};
+        skip_newlines();
+        if (at_word("in")) {
+            ++pos;
+            size_t first = pos;
+            while (at(TokKind::Word)) ++pos;
+            Word* words = script.arena.alloc<Word>(pos - first);
+            for (size_t i = first; i < pos; ++i) words[i - first] = {toks[i].text, toks[i].flags};
+            n->words = words;
+            n->nwords = pos - first;
+            if (!at(TokKind::Semi) && !at(TokKind::Newline)) return fail(peek());
+            ++pos;
+        } else {
+            n->for_args = true;
+            if (at(TokKind::Semi)) ++pos;
+        }
+        skip_newlines();
+        if (!expect("do")) return nullptr;
+        n->b = parse_list({"done"});
+        if (failed || !expect("done")) return nullptr;
+        return n;
+    }
+
+    Node* parse_function(const Token& tok, std::string_view name) {
+        if (!is_name(name)) return fail(&tok);
+        skip_newlines();
+        Node* n = node(NodeKind::Function);
+        n->name = {name, 0};
+        n->a = parse_command();
+        return failed ? nullptr : n;
+    }
+};
+
+void report_syntax_error(const Script& script, const Token* bad) {
+    std::cerr << "dgsh: ";
+    if (!script.name.empty()) std::cerr << script.name << ": ";
+    if (!bad) {
+        std::cerr << "syntax error: unexpected end of file" << std::endl;
+        return;
+    }
+    std::string near = bad->kind == TokKind::Newline ? "newline" : std::string(bad->text);
+    // A token from an alias body has no line in the source
+    const char* at = bad->text.data();
+    if (!script.name.empty() && at >= script.source.data() && at <= script.source.data() + script.source.size()) {
+        size_t line = 1 + std::count(script.source.data(), at, '\n');
+        std::cerr << "line " << line << ": ";
+    }
+    std::cerr << "syntax error near unexpected token `" << near << "'" << std::endl;
+}
+
+// --- On-disk cache of parsed trees ---
+//
+// One file per script: a header identifying the source file, the source
+// text itself, then the tree in pre-order. Words are stored as offsets
+// into the source, so loading is one read and a linear walk. The magic's
+// version changes whenever the lexer's word flags do.
+
+constexpr char CACHE_MAGIC[8] = {'D', 'G', 'S', 'H', 'A', 'S', 'T', '5'};
+constexpr uint32_t NO_VIEW = UINT32_MAX;
+
+class TreeWriter {
+public:
+    explicit TreeWriter(const Script& script) : src(script.source) {}
+    std::string out;
+
+    template <class T>
+    void put(T v) {
+        out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    void view(std::string_view v) {
+        if (!v.data()) {
+            put(NO_VIEW);
+            put(uint32_t(0));
+            return;
+        }
+        put(static_cast<uint32_t>(v.data() - src.data()));
+        put(static_cast<uint32_t>(v.size()));
+    }
+
+    void word(const Word& w) {
+        view(w.raw);
+        put(w.flags);
+    }
+
+    void pipeline(const Pipeline& p) {
+        put(uint8_t(p.background | p.timed << 1));
+        put(p.ncmds);
+        for (uint32_t i = 0; i < p.ncmds; ++i) {
+            const Command& c = p.cmds[i];
+            put(c.nwords);
+            for (uint32_t j = 0; j < c.nwords; ++j) word(c.words[j]);
+            put(c.nredirs);
+            for (uint32_t j = 0; j < c.nredirs; ++j) {
+                put(static_cast<uint8_t>(c.redirs[j].kind));
+                put(static_cast<int32_t>(c.redirs[j].fd));
+                word(c.redirs[j].target);
+                view(c.redirs[j].body);
+            }
+        }
+    }
+
+    void node(const Node* n) {
+        put(uint8_t(n != nullptr));
+        if (!n) return;
+        put(static_cast<uint8_t>(n->kind));
+        put(uint8_t(n->background | n->for_args << 1));
+        switch (n->kind) {
+        case NodeKind::Command: pipeline(*n->pipeline); break;
+        case NodeKind::List:
+            put(n->nitems);
+            for (uint32_t i = 0; i < n->nitems; ++i) node(n->items[i]);
+            break;
+        case NodeKind::For:
+            word(n->name);
+            put(n->nwords);
+            for (uint32_t i = 0; i < n->nwords; ++i) word(n->words[i]);
+            break;
+        case NodeKind::Function: word(n->name); break;
+        default: break;
+        }
+        node(n->a);
+        node(n->b);
+        node(n->c);
+    }
+
+private:
+    std::string_view src;
+};
+
+class TreeReader {
+public:
+    TreeReader(Script& script, std::string_view data) : script(script), data(data) {}
+    bool ok = true;
+
+    template <class T>
+    T get() {
+        T v{};
+        if (data.size() < sizeof(T)) {
+            ok = false;
+            return v;
+        }
+        memcpy(&v, data.data(), sizeof(T));
+        data.remove_prefix(sizeof(T));
+        return v;
+    }
+
+    std::string_view bytes(size_t n) {
+        if (data.size() < n) {
+            ok = false;
+            return {};
+        }
+        std::string_view v = data.substr(0, n);
+        data.remove_prefix(n);
+        return v;
+    }
+
+    // Element count, checked against what's left so a corrupt file can't
+    // make us allocate wildly.
+    uint32_t count() {
+        uint32_t n = get<uint32_t>();
+        if (n > data.size()) ok = false;
+        return ok ? n : 0;
+    }
+
+    std::string_view view() {
+        uint32_t off = get<uint32_t>();
+        uint32_t len = get<uint32_t>();
+        if (off == NO_VIEW) return {};
+        if (off > script.source.size() || len > script.source.size() - off) {
+            ok = false;
+            return {};
+        }
+        return std::string_view(script.source).substr(off, len);
+    }
+
+    Word word() {
+        std::string_view raw = view();
+        return {raw, get<uint8_t>()};
+    }
+
+    const Pipeline* pipeline() {
+        Pipeline* p = script.arena.alloc<Pipeline>(1);
+        uint8_t flags = get<uint8_t>();
+        p->background = flags & 1;
+        p->timed = flags >> 1 & 1;
+        p->ncmds = count();
+        Command* cmds = script.arena.alloc<Command>(p->ncmds);
+        p->cmds = cmds;
+        for (uint32_t i = 0; i < p->ncmds && ok; ++i) {
+            Command& c = cmds[i];
+            c.nwords = count();
+            Word* words = script.arena.alloc<Word>(c.nwords);
+            for (uint32_t j = 0; j < c.nwords; ++j) words[j] = word();
+            c.words = words;
+            c.nredirs = count();
+            Redir* redirs = script.arena.alloc<Redir>(c.nredirs);
+            for (uint32_t j = 0; j < c.nredirs; ++j) {
+                uint8_t kind = get<uint8_t>();
+                if (kind > static_cast<uint8_t>(RedirKind::AppendErr)) ok = false;
+                redirs[j].kind = static_cast<RedirKind>(kind);
+                redirs[j].fd = get<int32_t>();
+                redirs[j].target = word();
+                redirs[j].body = view();
+            }
+            c.redirs = redirs;
+        }
+        return p;
+    }
+
+    const Node* node(int depth = 0) {
+        if (!get<uint8_t>() || !ok) return nullptr;
+        uint8_t kind = get<uint8_t>();
+        if (kind > static_cast<uint8_t>(NodeKind::Function) || depth > 1000) {
+            ok = false;
+            return nullptr;
+        }
+        Node* n = script.arena.alloc<Node>(1);
+        n->kind = static_cast<NodeKind>(kind);
+        uint8_t flags = get<uint8_t>();
+        n->background = flags & 1;
+        n->for_args = flags & 2;
+        switch (n->kind) {
+        case NodeKind::Command: n->pipeline = pipeline(); break;
+        case NodeKind::List: {
+            n->nitems = count();
+            const Node** items = script.arena.alloc<const Node*>(n->nitems);
+            for (uint32_t i = 0; i < n->nitems && ok; ++i) items[i] = node(depth + 1);
+            n->items = items;
+            break;
+        }
+        case NodeKind::For: {
+            n->name = word();
+            n->nwords = count();
+            Word* words = script.arena.alloc<Word>(n->nwords);
+            for (uint32_t i = 0; i < n->nwords; ++i) words[i] = word();
+            n->words = words;
+            break;
+        }
+        case NodeKind::Function: n->name = word(); break;
+        default: break;
+        }
+        n->a = node(depth + 1);
+        n->b = node(depth + 1);
+        n->c = node(depth + 1);
+        return ok ? n : nullptr;
+    }
+
+private:
+    Script& script;
+    std::string_view data;
+};
+
+bool read_file(const std::string& path, std::string& out) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) out.reserve(st.st_size);
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) out.append(buf, n);
+    close(fd);
+    return n == 0;
+}
+
+std::string cache_file(const char* dir, const std::string& path) {
+    uint64_t h = 14695981039346656037ull;
+    for (char c : path) h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.ast", static_cast<unsigned long long>(h));
+    return dir + std::string(name);
+}
+
+struct CacheKey {
+    std::string path;
+    int64_t mtime_ns;
+    int64_t size;
+};
+
+std::shared_ptr<Script> cache_load(const std::string& file, const CacheKey& key, const std::string& name) {
+    std::string data;
+    if (!read_file(file, data)) return nullptr;
+    auto script = std::make_shared<Script>();
+    script->name = name;
+    TreeReader in(*script, data);
+    if (in.bytes(sizeof(CACHE_MAGIC)) != std::string_view(CACHE_MAGIC, sizeof(CACHE_MAGIC))) return nullptr;
+    if (in.get<int64_t>() != key.mtime_ns || in.get<int64_t>() != key.size) return nullptr;
+    if (in.bytes(in.count()) != key.path || !in.ok) return nullptr;
+    script->source = std::string(in.bytes(in.count()));
+    if (!in.ok) return nullptr;
+    script->root = in.node();
+    return in.ok ? script : nullptr;
+}
+
+void cache_store(const std::string& file, const CacheKey& key, const Script& script) {
+    TreeWriter out(script);
+    out.out.append(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    out.put(key.mtime_ns);
+    out.put(key.size);
+    out.put(static_cast<uint32_t>(key.path.size()));
+    out.out += key.path;
+    out.put(static_cast<uint32_t>(script.source.size()));
+    out.out += script.source;
+    out.node(script.root);
+    // Write-then-rename, so a concurrent reader sees the old file or the new one
+    std::string tmp = file + "." + std::to_string(getpid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+    bool ok = write(fd, out.out.data(), out.out.size()) == static_cast<ssize_t>(out.out.size());
+    close(fd);
+    if (!ok || rename(tmp.c_str(), file.c_str()) != 0) unlink(tmp.c_str());
+}
+
+// --- Execution ---
+
+enum class Flow { Next, Break, Continue, Return, Interrupt };
+Flow flow = Flow::Next;
+int flow_levels = 0;  // loops a break/continue still has to leave
+int loop_depth = 0;
+int func_depth = 0;
+bool notify_jobs = true;
+
+struct FunctionDef {
+    std::shared_ptr<Script> owner;  // keeps the tree alive
+    const Node* body;
+};
+std::unordered_map<std::string, FunctionDef> functions;
+std::shared_ptr<Script> running;  // script whose nodes are executing
+const Node* exec_tail = nullptr;  // command to exec instead of spawning, if any
+
+bool stopped() {
+    return flow != Flow::Next || shell_exiting;
+}
+
+// After a loop's condition or body: true if the loop has to end.
+bool leave_loop() {
+    switch (flow) {
+    case Flow::Next: return shell_exiting;
+    case Flow::Break:
+        if (--flow_levels == 0) flow = Flow::Next;
+        return true;
+    case Flow::Continue:
+        if (--flow_levels == 0) {
+            flow = Flow::Next;
+            return false;
+        }
+        return true;
+    default: return true;
+    }
+}
+
+// Exported variables stay in the environment, the rest are shell variables.
+void set_var(const std::string& name, const std::string& value) {
+    if (getenv(name.c_str())) setenv(name.c_str(), value.c_str(), 1);
+    else shell_vars[name] = value;
+}
+
+bool is_assignment(const Word& w) {
+    size_t eq = w.raw.find('=');
+    return eq != std::string_view::npos && is_name(w.raw.substr(0, eq));
+}
+
+int run_node(const Node* n);
+
+int call_function(const FunctionDef& def, const std::vector<std::string>& args) {
+    FunctionDef keep = def;  // the body may redefine its own function
+    std::vector<std::string> saved(args.begin() + 1, args.end());
+    saved.swap(positional_params);
+    int saved_loops = loop_depth;
+    loop_depth = 0;
+    ++func_depth;
+    int status = run_node(keep.body);
+    --func_depth;
+    loop_depth = saved_loops;
+    positional_params.swap(saved);
+    if (flow == Flow::Return) flow = Flow::Next;
+    return status;
+}
+
+int loop_control(const std::vector<std::string>& args) {
+    const std::string& cmd = args[0];
+    if (cmd == "return") {
+        if (func_depth == 0) {
+            std::cerr << "dgsh: return: can only `return' from a function" << std::endl;
+            return 1;
+        }
+        flow = Flow::Return;
+        return args.size() > 1 ? atoi(args[1].c_str()) & 0xff : last_status;
+    }
+    if (loop_depth == 0) {
+        std::cerr << "dgsh: " << cmd << ": only meaningful in a loop" << std::endl;
+        return 0;
+    }
+    int levels = args.size() > 1 ? atoi(args[1].c_str()) : 1;
+    if (levels < 1) {
+        std::cerr << "dgsh: " << cmd << ": " << args[1] << ": loop count out of range" << std::endl;
+        return 1;
+    }
+    flow = cmd == "break" ? Flow::Break : Flow::Continue;
+    flow_levels = std::min(levels, loop_depth);
+    return 0;
+}
+
+bool is_assignment_command(const Node* n) {
+    const Command& first = n->pipeline->cmds[0];
+    return n->pipeline->ncmds == 1 && !n->background && first.nwords > 0 &&
+           std::all_of(first.words, first.words + first.nwords, is_assignment);
+}
+
+int run_command(const Node* n) {
+    const Command& first = n->pipeline->cmds[0];
+    if (is_assignment_command(n)) {
+        // Values are expanded but never globbed. The status is that of the
+        // last command substitution, if there was one.
+        uint64_t before = substitutions_run;
+        for (uint32_t i = 0; i < first.nwords; ++i) {
+            std::string a = expanded_value(first.words[i]);
+            auto eq = a.find('=');
+            set_var(a.substr(0, eq), a.substr(eq + 1));
+        }
+        return substitutions_run != before ? last_status : 0;
+    }
+    std::vector<CmdSegment> segments;
+    {
+        TraceSpan span("expand");
+        segments = lower_pipeline(*n->pipeline);
+    }
+    if (n->background) segments.back().background = true;
+    bool timed = n->pipeline->timed;
+    if (segments.size() == 1 && !n->background && !timed && !segments[0].args.empty()) {
+        const auto& args = segments[0].args;
+        if (args[0] == "break" || args[0] == "continue" || args[0] == "return") return loop_control(args);
+        auto fn = functions.find(args[0]);
+        if (fn != functions.end()) return call_function(fn->second, args);
+    }
+    auto no_lines = [](std::string&) { return false; };
+    if (!collect_heredocs(segments, script_heredoc_lines ? script_heredoc_lines : no_lines)) return 1;
+    if (n == exec_tail && segments.size() == 1 && !n->background && !timed && !segments[0].args.empty() &&
+        !find_builtin(segments[0].args[0]) && !cat_in_process(segments[0].args))
+        return exec_stage(segments[0]);
+    int status = execute(segments, timed);
+    if (notify_jobs) jobs_notify(false);
+    // ^C killed the foreground job: stop the whole script, like other shells
+    if (status == 128 + SIGINT && !n->background) flow = Flow::Interrupt;
+    return status;
+}
+
+// The command a tree ends with, if nothing runs after it: the last item
+// of a list, or the right side of && or ||.
+const Node* tail_command(const Node* n) {
+    while (n) {
+        switch (n->kind) {
+        case NodeKind::Command: return n;
+        case NodeKind::List: n = n->nitems ? n->items[n->nitems - 1] : nullptr; break;
+        case NodeKind::And:
+        case NodeKind::Or: n = n->b; break;
+        default: return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+std::vector<std::string> for_items(const Node* n) {
+    if (n->for_args) return positional_params;
+    std::vector<std::string> items;
+    for (uint32_t i = 0; i < n->nwords; ++i) {
+        std::string_view raw = n->words[i].raw;
+        // "$@" is the one expansion that makes several words
+        if (raw == "\"$@\"" || raw == "$@" || raw == "$*") {
+            items.insert(items.end(), positional_params.begin(), positional_params.end());
+        } else {
+            expand_word_fields(n->words[i], items);
+        }
+    }
+    return items;
+}
+
+int run_loop(const Node* n) {
+    int status = 0;
+    ++loop_depth;
+    if (n->kind == NodeKind::For) {
+        std::string name(n->name.raw);
+        for (const auto& item : for_items(n)) {
+            set_var(name, item);
+            status = run_node(n->b);
+            if (leave_loop()) break;
+        }
+    } else {
+        for (;;) {
+            int cond = run_node(n->a);
+            if (leave_loop()) break;
+            if ((cond == 0) != (n->kind == NodeKind::While)) break;
+            status = run_node(n->b);
+            if (leave_loop()) break;
+        }
+    }
+    --loop_depth;
+    return status;
+}
+
+int run_node(const Node* n) {
+    if (!n) return 0;
+    int status = 0;
+    switch (n->kind) {
+    case NodeKind::Command: status = run_command(n); break;
+    case NodeKind::Not: status = run_node(n->a) == 0 ? 1 : 0; break;
+    case NodeKind::And:
+    case NodeKind::Or:
+        status = run_node(n->a);
+        if (!stopped() && (status == 0) == (n->kind == NodeKind::And)) status = run_node(n->b);
+        break;
+    case NodeKind::List:
+        for (uint32_t i = 0; i < n->nitems && !stopped(); ++i) status = run_node(n->items[i]);
+        break;
+    case NodeKind::If:
+        status = run_node(n->a);
+        if (stopped()) break;
+        status = status == 0 ? run_node(n->b) : n->c ? run_node(n->c) : 0;
+        break;
+    case NodeKind::While:
+    case NodeKind::Until:
+    case NodeKind::For: status = run_loop(n); break;
+    case NodeKind::Function: functions[std::string(n->name.raw)] = {running, n->a}; break;
+    }
+    last_status = status;
+    return status;
+}
+
+} // namespace
+
+std::shared_ptr<Script> script_parse(std::string source, const std::string& name, bool* incomplete,
+                                     uint8_t open_incomplete) {
+    TraceSpan span("parse");
+    if (incomplete) *incomplete = false;
+    auto script = std::make_shared<Script>();
+    script->name = name;
+    script->source = std::move(source);
+    std::vector<Token> tokens;
+    uint8_t open = 0;
+    lex_line(script->source, tokens, &open);
+    if (incomplete && (open & open_incomplete)) {
+        *incomplete = true;
+        return nullptr;
+    }
+    if (alias_expansion) expand_aliases(tokens, script->alias_bodies);
+    ScriptParser parser(*script, tokens);
+    script->root = parser.parse();
+    if (!parser.failed) return script;
+    if (incomplete && parser.hit_eof) *incomplete = true;
+    else report_syntax_error(*script, parser.bad);
+    return nullptr;
+}
+
+std::shared_ptr<Script> script_load(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return nullptr;
+    const char* dir = getenv("DGSH_SCRIPT_CACHE");
+    std::string file;
+    CacheKey key;
+    if (dir && *dir) {
+        char real[PATH_MAX];
+        key = {realpath(path.c_str(), real) ? real : path,
+               static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec, st.st_size};
+        file = cache_file(dir, key.path);
+        TraceSpan span("cache");
+        if (auto script = cache_load(file, key, path)) return script;
+    }
+    std::string source;
+    if (!read_file(path, source)) return nullptr;
+    auto script = script_parse(std::move(source), path);
+    if (script && !file.empty() && script->alias_bodies.empty()) {
+        mkdir(dir, 0700);
+        cache_store(file, key, *script);
+    }
+    return script;
+}
+
+bool script_is_simple(const Script& script) {
+    return script.root && script.root->kind == NodeKind::Command && !is_assignment_command(script.root);
+}
+
+bool script_has_function(const std::string& name) {
+    return functions.count(name) != 0;
+}
+
+int script_run(const std::shared_ptr<Script>& script, bool interactive, bool exec_last) {
+    auto saved = running;
+    bool saved_notify = notify_jobs;
+    const Node* saved_tail = exec_tail;
+    running = script;
+    notify_jobs = !interactive;
+    exec_tail = exec_last ? tail_command(script->root) : nullptr;
+    int status = run_node(script->root);
+    // Nothing unwinds past the top of a script
+    if (flow != Flow::Next) flow = Flow::Next;
+    running = saved;
+    notify_jobs = saved_notify;
+    exec_tail = saved_tail;
+    return status;
+}
+
+int script_run_fd(int fd, const std::string& name) {
+    const size_t BLOCK = 64 * 1024;
+    std::string pending;
+    bool eof = false;
+    // While a compound command spans blocks, re-parsing all of it on every
+    // block is quadratic in its length: wait until it has doubled, unless
+    // the input has run dry for now and the command may already be whole.
+    size_t parse_at = 0;
+    while (!shell_exiting) {
+        // Everything up to the last newline read so far, or all of it at EOF
+        size_t end = pending.size();
+        bool drained = true;
+        if (!eof) {
+            size_t used = pending.size();
+            pending.resize(used + BLOCK);
+            ssize_t n;
+            do n = read(fd, &pending[used], BLOCK);
+            while (n < 0 && errno == EINTR);
+            pending.resize(used + (n > 0 ? n : 0));
+            eof = n <= 0;
+            drained = n < (ssize_t)BLOCK;
+            size_t nl = pending.rfind('\n');
+            end = eof ? pending.size() : nl == std::string::npos ? 0 : nl + 1;
+        }
+        if (end == 0) {
+            if (eof) break;
+            continue;
+        }
+        if (!eof && !drained && end < parse_at) continue;
+        bool incomplete = false;
+        auto script = script_parse(pending.substr(0, end), name, eof ? nullptr : &incomplete,
+                                   LEX_OPEN_QUOTE | LEX_OPEN_HEREDOC);
+        if (incomplete) {  // a command spans the next block
+            parse_at = 2 * end;
+            continue;
+        }
+        parse_at = 0;
+        if (!script) return 2;
+        pending.erase(0, end);
+        if (script->root) last_status = script_run(script);
+        if (eof && pending.empty()) break;
+    }
+    return last_status;
+}
@@ -0,0 +1,78 @@
+#ifndef GOONSH_SCRIPT_H
+#define GOONSH_SCRIPT_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "arena.h"
+#include "parser.h"
+
+// Script engine. A whole source (a script file, ~/.dgshrc, an interactive
+// line) is lexed and parsed once into a tree of pipelines joined by
+// ; & && || and !, if/elif/else, while/until, for, { } groups and
+// functions (`name() {...}` or `function name {...}`), with break,
+// continue and return. Nodes live in the script's arena and point into its
+// source, so loop and function bodies run straight from the tree: only word
+// expansion happens per iteration.
+
+enum class NodeKind : uint8_t { Command, Not, And, Or, List, If, While, Until, For, Function };
+
+struct Node {
+    NodeKind kind;
+    bool background;           // Command followed by &
+    bool for_args;             // For without `in`: loop over $1, $2...
+    const Pipeline* pipeline;  // Command
+    const Node* a;             // Not/And/Or operand, If/While/Until condition, Function body
+    const Node* b;             // And/Or right side, If then-branch, loop body
+    const Node* c;             // If else-branch (elif is a nested If)
+    const Node* const* items;  // List
+    uint32_t nitems;
+    Word name;                 // For variable, Function name
+    const Word* words;         // For word list
+    uint32_t nwords;
+};
+
+struct Script {
+    std::string name;    // for error messages; empty for interactive input
+    std::string source;  // every Word in the tree points in here...
+    // ...or into one of these, for words that came from an alias
+    std::vector<std::shared_ptr<const std::string>> alias_bodies;
+    Arena arena;
+    const Node* root = nullptr;  // nullptr for a blank or comment-only source
+};
+
+// Parse `source`. Returns nullptr after printing a syntax error, except
+// that with `incomplete` non-null a source that merely stops early (inside
+// a compound command, after && || or |, or inside one of the
+// `open_incomplete` constructs, see lex_line) sets it instead.
+std::shared_ptr<Script> script_parse(std::string source, const std::string& name, bool* incomplete = nullptr,
+                                     uint8_t open_incomplete = 0);
+// Read and parse a script file. With DGSH_SCRIPT_CACHE=DIR, parsed trees
+// are cached in DIR keyed by path, mtime and size, so an unchanged script
+// is never parsed twice.
+std::shared_ptr<Script> script_load(const std::string& path);
+
+// True if the script is one plain pipeline, with no lists, control flow
+// or variable assignments.
+bool script_is_simple(const Script& script);
+// Is `name` a function defined by a script run so far?
+bool script_has_function(const std::string& name);
+// Run a parsed script; returns the status of the last command. Unless
+// `interactive`, finished background jobs are dropped as it goes. With
+// `exec_last`, a plain external command that ends the script replaces the
+// shell instead of being spawned and waited for (`dgsh -c`).
+int script_run(const std::shared_ptr<Script>& script, bool interactive = false, bool exec_last = false);
+// Run the script read from `fd` (stdin batch mode) a 64 KiB block at a
+// time, the complete commands of each block parsed and run before the
+// next is read. `name` is for error messages; a syntax error stops it
+// with status 2. Unlike bash, which reads its input a byte at a time,
+// commands that read the same fd start after the block read so far.
+int script_run_fd(int fd, const std::string& name);
+
+// Where heredoc bodies that aren't in the source come from (the
+// interactive `> ` prompt). Unset, commands needing one fail.
+extern std::function<bool(std::string&)> script_heredoc_lines;
+
+#endif // GOONSH_SCRIPT_H
@@ -0,0 +1,436 @@
+#include "serve.h"
+#include "alias.h"
+#include "builtins.h"
+#include "cmdhash.h"
+#include "config.h"
+#include "exec.h"
+#include "jobs.h"
+#include "script.h"
+#include "servemsg.h"
+#include "shell.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+extern char** environ;
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 29)
+#define HAVE_SPAWN_CHDIR 1
+#else
+#define HAVE_SPAWN_CHDIR 0
+#endif
+
+namespace {
+
+const size_t PARSE_CACHE_MAX = 1024;
+
+// One client, from accept until its exit status is written back.
+struct Conn {
+    int sock = -1;
+    std::string buf;            // the request so far, length included
+    int fds[3] = {-1, -1, -1};  // the client's stdin, stdout and stderr
+    pid_t pid = -1;             // the fork running the request
+    int pidfd = -1;
+};
+
+struct Server {
+    std::string path;
+    int listener = -1;
+    int epoll = -1;
+    int signals = -1;
+    sigset_t old_mask;
+    bool stopping = false;
+    // Both fds of a connection, its socket and its child's pidfd
+    std::unordered_map<int, std::shared_ptr<Conn>> watched;
+    std::unordered_map<std::string, std::shared_ptr<Script>> parsed;
+};
+
+void close_fd(int& fd) {
+    if (fd == -1) return;
+    close(fd);
+    fd = -1;
+}
+
+void watch(Server& s, int fd, uint32_t events, const std::shared_ptr<Conn>& c) {
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    epoll_ctl(s.epoll, EPOLL_CTL_ADD, fd, &ev);
+    if (c) s.watched[fd] = c;
+}
+
+// Forget the client's socket; a request still running is hung up on.
+void drop_client(Server& s, Conn& c) {
+    if (c.pid > 0) kill(-c.pid, SIGHUP);
+    for (int& fd : c.fds) close_fd(fd);
+    s.watched.erase(c.sock);
+    close_fd(c.sock);  // closing also takes it out of the epoll set
+}
+
+// Send the exit status; a client that has gone away just misses it.
+void reply(Server& s, Conn& c, int status) {
+    int32_t code = status;
+    if (c.sock != -1) send(c.sock, &code, sizeof(code), MSG_NOSIGNAL | MSG_DONTWAIT);
+    drop_client(s, c);
+}
+
+// Cached parse of a command string. Syntax errors are the client's: the
+// parser reports them on our stderr, which points at theirs meanwhile.
+std::shared_ptr<Script> parse(Server& s, const std::string& command, int err) {
+    auto it = s.parsed.find(command);
+    if (it != s.parsed.end()) return it->second;
+    int saved = dup(STDERR_FILENO);
+    dup2(err, STDERR_FILENO);
+    auto script = script_parse(command, "-c");
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    if (!script) return nullptr;
+    if (s.parsed.size() >= PARSE_CACHE_MAX) s.parsed.clear();
+    s.parsed.emplace(command, script);
+    return script;
+}
+
+// In the fork: become the client's shell and run the request.
+[[noreturn]] void run_request(Server& s, Conn& c, const ServeRequest& req, const std::shared_ptr<Script>& script) {
+    // Lead a process group that everything the request starts stays in,
+    // for drop_client() to hang up on
+    setpgid(0, 0);
+    exec_job_groups = false;
+    sigprocmask(SIG_SETMASK, &s.old_mask, nullptr);
+    signal(SIGPIPE, SIG_DFL);
+    close(s.listener);
+    close(s.epoll);
+    close(s.signals);
+    for (int i = 0; i < 3; ++i) {
+        if (c.fds[i] == i) continue;
+        dup2(c.fds[i], i);
+        close(c.fds[i]);
+    }
+    jobs_init();
+    if (!req.cwd.empty()) {
+        if (chdir(req.cwd.c_str()) != 0) {
+            std::cerr << "dgsh: " << req.cwd << ": " << strerror(errno) << std::endl;
+            _exit(1);
+        }
+        setenv("PWD", req.cwd.c_str(), 1);
+    }
+    for (const auto& e : req.env) {
+        size_t eq = e.find('=');
+        setenv(e.substr(0, eq).c_str(), e.c_str() + eq + 1, 1);
+    }
+    if (!req.args.empty()) {
+        script_name = req.args[0];
+        positional_params.assign(req.args.begin() + 1, req.args.end());
+    }
+    int status = script_run(script, false, true);
+    std::cout.flush();
+    fflush(nullptr);
+    _exit(status & 0xff);
+}
+
+// Can the request be spawned straight from here? Only one external
+// command qualifies, with no redirections and no words that would expand
+// differently in the client's directory and environment ($, globs, ~).
+bool spawnable(const Script& script, const ServeRequest& req) {
+    if (!HAVE_SPAWN_CHDIR || !script_is_simple(script)) return false;
+    const Pipeline& p = *script.root->pipeline;
+    if (p.ncmds != 1 || p.background || p.timed || p.cmds[0].nwords == 0 || p.cmds[0].nredirs != 0) return false;
+    for (uint32_t i = 0; i < p.cmds[0].nwords; ++i) {
+        const Word& w = p.cmds[0].words[i];
+        if ((w.flags & (TOK_DOLLAR | TOK_GLOB)) || w.raw[0] == '~') return false;
+    }
+    // Resolved with our $PATH, so the client mustn't have another
+    for (const auto& e : req.env)
+        if (e.rfind("PATH=", 0) == 0) return false;
+    return true;
+}
+
+// Spawn a spawnable() request (CLONE_VFORK: nothing of the server is
+// copied): our environment with the overlay on top, the client's fds and
+// directory, default signal dispositions and a process group of its own.
+// -1 if it didn't start.
+pid_t spawn_request(const Conn& c, const ServeRequest& req, std::vector<std::string>& args) {
+    if (args.empty() || find_builtin(args[0]) || script_has_function(args[0])) return -1;
+    std::string resolved = args[0].find('/') != std::string::npos ? args[0] : cmdhash_lookup(args[0]);
+    if (resolved.empty()) return -1;
+
+    std::vector<std::string> overlay = req.env;
+    if (!req.cwd.empty()) overlay.push_back("PWD=" + req.cwd);
+    std::vector<char*> envp;
+    for (char** e = environ; *e; ++e) {
+        size_t len = strcspn(*e, "=") + 1;  // NAME=
+        bool replaced = false;
+        for (const auto& o : overlay) replaced |= o.compare(0, len, *e, len) == 0;
+        if (!replaced) envp.push_back(*e);
+    }
+    for (auto& o : overlay) envp.push_back(&o[0]);
+    envp.push_back(nullptr);
+    std::vector<char*> argv;
+    for (auto& a : args) argv.push_back(&a[0]);
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+#if HAVE_SPAWN_CHDIR
+    if (!req.cwd.empty()) posix_spawn_file_actions_addchdir_np(&actions, req.cwd.c_str());
+#endif
+    for (int i = 0; i < 3; ++i) posix_spawn_file_actions_adddup2(&actions, c.fds[i], i);
+    sigset_t defaults, mask;
+    sigemptyset(&defaults);
+    for (int sig : {SIGINT, SIGQUIT, SIGTERM, SIGHUP, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE, SIGWINCH})
+        sigaddset(&defaults, sig);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+    pid_t pid = -1;
+    if (posix_spawn(&pid, resolved.c_str(), &actions, &attr, argv.data(), envp.data()) != 0) pid = -1;
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return pid;
+}
+
+void start_request(Server& s, const std::shared_ptr<Conn>& c) {
+    ServeRequest req;
+    std::string_view payload(c->buf);
+    payload.remove_prefix(sizeof(uint32_t));
+    if (c->fds[2] == -1 || !serve_decode(payload, req)) {
+        drop_client(s, *c);
+        return;
+    }
+    auto script = parse(s, req.command, c->fds[2]);
+    if (!script || !script->root) {
+        reply(s, *c, script ? 0 : 2);
+        return;
+    }
+    // Revalidated here, the index is fresh in every fork that inherits it
+    cmdhash_commands();
+    pid_t pid = -1;
+    if (spawnable(*script, req)) {
+        auto segments = lower_pipeline(*script->root->pipeline);
+        pid = spawn_request(*c, req, segments[0].args);
+    }
+    // Anything else, or a spawn that failed (and now gets reported the
+    // usual way), runs in a fork of this shell
+    if (pid < 0) {
+        std::cout.flush();
+        pid = fork();
+        if (pid == 0) run_request(s, *c, req, script);
+        // Also set from here so a hangup can't come before the child's
+        if (pid > 0) setpgid(pid, pid);
+    }
+    for (int& fd : c->fds) close_fd(fd);
+    if (pid < 0) {
+        perror("dgsh: --serve: fork");
+        reply(s, *c, 126);
+        return;
+    }
+    c->pid = pid;
+    c->pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (c->pidfd < 0) {
+        // No pidfd to wait through: wait right here
+        int status;
+        waitpid(pid, &status, 0);
+        c->pid = -1;
+        reply(s, *c, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+        return;
+    }
+    watch(s, c->pidfd, EPOLLIN, c);
+}
+
+void finish_request(Server& s, const std::shared_ptr<Conn>& c) {
+    int status = 0;
+    while (waitpid(c->pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    c->pid = -1;
+    s.watched.erase(c->pidfd);
+    close_fd(c->pidfd);
+    if (c->sock != -1) reply(s, *c, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+}
+
+// Take in what the client sent: the request, with its fds on the first
+// byte. Anything after the request, or a hang-up, drops the client.
+void client_readable(Server& s, const std::shared_ptr<Conn>& c) {
+    for (;;) {
+        char chunk[16 * 1024];
+        struct iovec iov = {chunk, sizeof(chunk)};
+        union {
+            char buf[CMSG_SPACE(3 * sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        ssize_t n = recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n < 0) {
+            drop_client(s, *c);
+            return;
+        }
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            std::vector<int> got(count);
+            memcpy(got.data(), CMSG_DATA(cmsg), count * sizeof(int));
+            bool take = count == 3 && c->fds[0] == -1 && c->buf.empty();
+            for (size_t i = 0; i < count; ++i) {
+                if (take) c->fds[i] = got[i];
+                else close(got[i]);
+            }
+        }
+        if (n == 0 || c->pid != -1 || (msg.msg_flags & MSG_CTRUNC)) {
+            drop_client(s, *c);
+            return;
+        }
+        c->buf.append(chunk, n);
+        if (c->buf.size() < sizeof(uint32_t)) continue;
+        uint32_t length;
+        memcpy(&length, c->buf.data(), sizeof(length));
+        size_t whole = sizeof(length) + length;
+        if (length > SERVE_MAX_REQUEST || c->buf.size() > whole) {
+            drop_client(s, *c);
+            return;
+        }
+        if (c->buf.size() == whole) {
+            start_request(s, c);
+            return;
+        }
+    }
+}
+
+void accept_clients(Server& s) {
+    for (;;) {
+        int sock = accept4(s.listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("dgsh: --serve: accept");
+            return;
+        }
+        auto c = std::make_shared<Conn>();
+        c->sock = sock;
+        watch(s, sock, EPOLLIN | EPOLLRDHUP, c);
+    }
+}
+
+void stop_accepting(Server& s) {
+    s.stopping = true;
+    close_fd(s.listener);
+    unlink(s.path.c_str());
+}
+
+// A Unix socket at s.path that only we can connect to. One that is left
+// over from a server that's gone is replaced; a live one is not.
+bool listen_on(Server& s) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (s.path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "dgsh: --serve: " << s.path << ": path too long" << std::endl;
+        return false;
+    }
+    memcpy(addr.sun_path, s.path.c_str(), s.path.size() + 1);
+    int live = serve_connect(s.path);
+    if (live >= 0) {
+        close(live);
+        std::cerr << "dgsh: --serve: " << s.path << ": already being served" << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (lstat(s.path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(s.path.c_str());
+    s.listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    mode_t old_umask = umask(077);
+    bool ok = s.listener >= 0 && bind(s.listener, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0 &&
+              listen(s.listener, SOMAXCONN) == 0;
+    umask(old_umask);
+    if (!ok) std::cerr << "dgsh: --serve: " << s.path << ": " << strerror(errno) << std::endl;
+    return ok;
+}
+
+} // namespace
+
+int serve(const std::string& path) {
+    // The warm state every request starts from
+    std::string prompt;
+    std::vector<std::string> rc_commands;
+    load_config(aliases, prompt, rc_commands);
+    alias_expansion = true;
+    if (!rc_commands.empty()) {
+        std::string rc_source;
+        for (const auto& rc_line : rc_commands) rc_source += rc_line + "\n";
+        if (auto rc = script_parse(std::move(rc_source), "~/.dgshrc")) last_status = script_run(rc);
+    }
+    cmdhash_commands();
+
+    Server s;
+    s.path = path;
+    if (!listen_on(s)) return 1;
+    // Requests are waited for through their pidfds: no SIGCHLD handler
+    // (the rc may have installed one) may reap them first. A client gone
+    // mid-reply is just dropped.
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_IGN);
+    sigset_t stop;
+    sigemptyset(&stop);
+    for (int sig : {SIGINT, SIGTERM, SIGHUP}) sigaddset(&stop, sig);
+    sigprocmask(SIG_BLOCK, &stop, &s.old_mask);
+    s.signals = signalfd(-1, &stop, SFD_NONBLOCK | SFD_CLOEXEC);
+    s.epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (s.signals < 0 || s.epoll < 0) {
+        perror("dgsh: --serve");
+        stop_accepting(s);
+        return 1;
+    }
+    watch(s, s.listener, EPOLLIN, nullptr);
+    watch(s, s.signals, EPOLLIN, nullptr);
+
+    struct epoll_event events[64];
+    while (!s.stopping || !s.watched.empty()) {
+        int n = epoll_wait(s.epoll, events, 64, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("dgsh: --serve: epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == s.listener && !s.stopping) {
+                accept_clients(s);
+            } else if (fd == s.signals) {
+                struct signalfd_siginfo info;
+                while (read(s.signals, &info, sizeof(info)) == sizeof(info)) {
+                }
+                if (!s.stopping) stop_accepting(s);
+            } else {
+                auto it = s.watched.find(fd);
+                if (it == s.watched.end()) continue;
+                auto c = it->second;
+                if (fd == c->pidfd) finish_request(s, c);
+                else client_readable(s, c);
+            }
+        }
+    }
+    if (!s.stopping) stop_accepting(s);
+    close_fd(s.epoll);
+    close_fd(s.signals);
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef GOONSH_SERVE_H
+#define GOONSH_SERVE_H
+
+#include <string>
+
+// `dgsh --serve SOCKET`: a shell that stays up and runs commands for
+// clients (dgsh-client, see servemsg.h for the protocol) connecting to a
+// Unix socket, so they skip starting a shell: the config, ~/.dgshrc, the
+// aliases and the PATH index are loaded once, and command strings are
+// parsed once and kept. Each request runs in a fork of that warm shell,
+// in the client's directory with its environment overlay on top, as
+// `dgsh -c` would: output goes straight to the client's own fds and a
+// plain external command at the end is exec'd. A request that is just
+// one external command, with nothing to expand, skips the fork: it is
+// spawned from the server with posix_spawn. One epoll loop accepts
+// connections, reads requests and collects exit statuses (through
+// pidfds), so any number of clients are served at once. The socket is
+// only accessible to our own user. SIGINT, SIGTERM or SIGHUP stop the
+// server once the requests under way have finished.
+
+// Serve on `path` until stopped; returns the exit status.
+int serve(const std::string& path);
+
+#endif // GOONSH_SERVE_H
@@ -0,0 +1,119 @@
+#include "servemsg.h"
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+void put_field(std::string& out, char tag, const std::string& value) {
+    out += tag;
+    out += value;
+    out += '\0';
+}
+
+} // namespace
+
+std::string serve_encode(const ServeRequest& req) {
+    std::string out;
+    put_field(out, 'D', req.cwd);
+    put_field(out, 'C', req.command);
+    for (const auto& e : req.env) put_field(out, 'E', e);
+    for (const auto& a : req.args) put_field(out, 'A', a);
+    return out;
+}
+
+bool serve_decode(std::string_view payload, ServeRequest& req) {
+    bool has_command = false;
+    while (!payload.empty()) {
+        size_t end = payload.find('\0');
+        if (end == std::string_view::npos || end == 0) return false;
+        std::string value(payload.substr(1, end - 1));
+        switch (payload[0]) {
+        case 'D': req.cwd = std::move(value); break;
+        case 'C':
+            req.command = std::move(value);
+            has_command = true;
+            break;
+        case 'E':
+            if (value.find('=') == std::string::npos) return false;
+            req.env.push_back(std::move(value));
+            break;
+        case 'A': req.args.push_back(std::move(value)); break;
+        default: return false;
+        }
+        payload.remove_prefix(end + 1);
+    }
+    return has_command;
+}
+
+int serve_connect(const std::string& path) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        int err = errno;
+        close(sock);
+        errno = err;
+        return -1;
+    }
+    return sock;
+}
+
+bool serve_send(int sock, const ServeRequest& req, const int fds[3]) {
+    std::string payload = serve_encode(req);
+    if (payload.size() > SERVE_MAX_REQUEST) {
+        errno = E2BIG;
+        return false;
+    }
+    uint32_t length = payload.size();
+    std::string message(reinterpret_cast<const char*>(&length), sizeof(length));
+    message += payload;
+
+    // The fds ride along with the first byte; the rest is plain writes
+    struct iovec iov = {&message[0], message.size()};
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, 3 * sizeof(int));
+
+    ssize_t n;
+    do n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+    for (size_t done = n; done < message.size(); done += n) {
+        n = send(sock, message.data() + done, message.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) n = 0;
+        else if (n <= 0) return false;
+    }
+    return true;
+}
+
+int serve_wait(int sock) {
+    int32_t status;
+    size_t got = 0;
+    while (got < sizeof(status)) {
+        ssize_t n = read(sock, reinterpret_cast<char*>(&status) + got, sizeof(status) - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        got += n;
+    }
+    return status;
+}
@@ -0,0 +1,41 @@
+#ifndef GOONSH_SERVEMSG_H
+#define GOONSH_SERVEMSG_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Wire format of `dgsh --serve` (see serve.h), shared with dgsh-client.
+// A request is one message on a fresh connection to the Unix socket: a
+// uint32 payload length, then the payload, with the client's stdin,
+// stdout and stderr attached to its first byte (SCM_RIGHTS), so output
+// streams straight to the client's own fds. The payload is NUL-terminated
+// fields, each led by a tag: 'D' the directory to run in, 'C' the
+// commands, 'E' a NAME=VALUE set on top of the server's environment, 'A'
+// $0 then the positional parameters, in order. The reply is the exit
+// status as an int32, after which the server closes the connection.
+
+struct ServeRequest {
+    std::string cwd;
+    std::string command;
+    std::vector<std::string> env;
+    std::vector<std::string> args;
+};
+
+constexpr uint32_t SERVE_MAX_REQUEST = 1 << 20;
+
+// The payload of `req`, without its length.
+std::string serve_encode(const ServeRequest& req);
+// Fill `req` from a payload; false if it is malformed.
+bool serve_decode(std::string_view payload, ServeRequest& req);
+
+// Client side. Connect to the server at `path`; -1 (errno set) if none
+// answers there.
+int serve_connect(const std::string& path);
+// Send `req` with fds[0..2] as the command's stdin, stdout and stderr.
+bool serve_send(int sock, const ServeRequest& req, const int fds[3]);
+// Wait for the reply: the exit status, or -1 if the server went away.
+int serve_wait(int sock);
+
+#endif // GOONSH_SERVEMSG_H
@@ -0,0 +1,8 @@
+#include "shell.h"
+
+std::vector<std::string> builtins = {"cd","ls","pwd","echo","cat","touch","rm","mkdir","rmdir","cp","mv","head","tail","grep","wc","whoami","date","env","export","unset","history","which","clear","alias","unalias","help","exit","quit","man","time","jobs","fg","bg","wait","hash","true","false","parallel"};
+std::map<std::string, std::string, std::less<>> shell_vars = {{"DGSH_THEME", "default"}};
+int last_status = 0;
+std::string script_name = "dgsh";
+std::vector<std::string> positional_params;
+bool shell_exiting = false;
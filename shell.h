@@ -0,0 +1,22 @@
+#ifndef GOONSH_SHELL_H
+#define GOONSH_SHELL_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Shell-wide state shared by the interactive loop, the parser's expansion
+// stage and completion.
+
+extern std::vector<std::string> builtins;
+// Shell variables; std::less<> allows lookups by string_view without a copy.
+extern std::map<std::string, std::string, std::less<>> shell_vars;
+extern int last_status;
+// $0 and $1, $2...: the script (or function) arguments.
+extern std::string script_name;
+extern std::vector<std::string> positional_params;
+// Set by `exit`; every input loop stops once it is true.
+extern bool shell_exiting;
+
+#endif // GOONSH_SHELL_H
@@ -0,0 +1,159 @@
+#include "subst.h"
+#include "builtins.h"
+#include "exec.h"
+#include "jobs.h"
+#include "script.h"
+#include "shell.h"
+#include "trace.h"
+#include <csignal>
+#include <cstdio>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+uint64_t substitutions_run = 0;
+
+namespace {
+
+// Buffers bigger than this go back to the allocator after use.
+const size_t MAX_KEPT_BUFFER = 1 << 20;
+
+// One capture buffer per nesting level of $(...). A deque, so a nested
+// substitution adding a level doesn't move the buffers of the outer ones.
+std::deque<std::string> buffers;
+size_t depth = 0;
+
+// std::cout's target while a builtin runs in-process.
+class StringSink : public std::streambuf {
+public:
+    explicit StringSink(std::string& out) : out(out) {}
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) out += traits_type::to_char_type(c);
+        return traits_type::not_eof(c);
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        out.append(s, n);
+        return n;
+    }
+
+private:
+    std::string& out;
+};
+
+int exit_code(int raw) {
+    if (raw < 0) return 1;
+    if (WIFSIGNALED(raw)) return 128 + WTERMSIG(raw);
+    return WEXITSTATUS(raw);
+}
+
+bool redirects_stdout(const CmdSegment& seg) {
+    for (const auto& r : seg.redirs) {
+        if (r.fd == STDOUT_FILENO) return true;
+    }
+    return false;
+}
+
+int run_in_process(CmdSegment& seg, std::string& buf) {
+    int status = 0;
+    if (redirects_stdout(seg)) {
+        // Its output goes elsewhere, leaving nothing to capture
+        run_builtin(seg, status);
+    } else {
+        std::cout.flush();
+        StringSink sink(buf);
+        std::streambuf* saved = std::cout.rdbuf(&sink);
+        run_builtin(seg, status);
+        std::cout.rdbuf(saved);
+    }
+    close_heredocs(seg);
+    return status;
+}
+
+// Run a whole script in a forked copy of the shell with stdout on a pipe.
+int run_in_subshell(const std::shared_ptr<Script>& script, std::string& buf) {
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) != 0) {
+        perror("pipe");
+        return 1;
+    }
+    // Anything still buffered would be written twice
+    std::cout.flush();
+    std::cerr.flush();
+    fflush(nullptr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(pipefd[1], STDOUT_FILENO);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        int status = script_run(script);
+        std::cout.flush();
+        fflush(nullptr);
+        _exit(status);
+    }
+    close(pipefd[1]);
+    if (pid < 0) {
+        perror("fork");
+        close(pipefd[0]);
+        return 1;
+    }
+    read_all(pipefd[0], buf);
+    close(pipefd[0]);
+    return exit_code(wait_child(pid));
+}
+
+int capture(std::string_view command, std::string& buf) {
+    auto script = script_parse(std::string(command), "");
+    if (!script) return 2;
+    if (!script->root) return 0;
+    if (!script_is_simple(*script)) return run_in_subshell(script, buf);
+
+    const Pipeline& pipeline = *script->root->pipeline;
+    if (pipeline.timed) return run_in_subshell(script, buf);
+    const Command& first = pipeline.cmds[0];
+    if (pipeline.ncmds == 1 && first.nwords > 0) {
+        // Only a name that is there before expansion can pick the fast path
+        if (first.words[0].flags & (TOK_DOLLAR | TOK_GLOB)) return run_in_subshell(script, buf);
+        std::string name = word_value(first.words[0]);
+        bool builtin = find_builtin(name) != nullptr;
+        if ((builtin && !is_pure_builtin(name, first.nwords)) || script_has_function(name) || name == "break" ||
+            name == "continue" || name == "return")
+            return run_in_subshell(script, buf);
+        if (builtin) {
+            auto segments = lower_pipeline(pipeline);
+            // 2>&1 and the like copy stdout, which has to be a real fd
+            if (!segments[0].redirs.empty() && !redirects_stdout(segments[0])) return run_in_subshell(script, buf);
+            auto no_lines = [](std::string&) { return false; };
+            if (!collect_heredocs(segments, no_lines)) return 1;
+            return run_in_process(segments[0], buf);
+        }
+    }
+    auto segments = lower_pipeline(pipeline);
+    auto no_lines = [](std::string&) { return false; };
+    if (!collect_heredocs(segments, no_lines)) return 1;
+    return capture_pipeline(segments, buf);
+}
+
+} // namespace
+
+void command_substitution(std::string_view command, std::string& out) {
+    TraceSpan span("subst");
+    ++substitutions_run;
+    if (depth == buffers.size()) buffers.emplace_back();
+    std::string& buf = buffers[depth];
+    buf.clear();
+    ++depth;
+    int status = capture(command, buf);
+    --depth;
+    size_t end = buf.find_last_not_of('\n');
+    if (end != std::string::npos) out.append(buf, 0, end + 1);
+    if (buf.capacity() > MAX_KEPT_BUFFER) std::string().swap(buf);
+    last_status = status;
+}
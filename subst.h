@@ -0,0 +1,27 @@
+#ifndef GOONSH_SUBST_H
+#define GOONSH_SUBST_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Command substitution: $(...) and `...`. The command runs as if in a
+// subshell and what it writes to stdout replaces it, minus trailing
+// newlines. How it runs depends on what it is:
+//  - a builtin with no effect on the shell (echo, pwd, which...) runs in
+//    the shell process with std::cout pointed at the capture buffer: no
+//    fork, no pipe;
+//  - a plain pipeline of external commands is spawned like any other,
+//    with the last stage writing into a pipe;
+//  - anything else (lists, control flow, functions, cd, assignments)
+//    runs in a forked copy of the shell so its changes stay there.
+// Capture buffers are kept per nesting level and reused.
+
+// Run `command` and append its output to `out`. Sets last_status.
+void command_substitution(std::string_view command, std::string& out);
+
+// Count of substitutions run so far; a bare assignment takes its status
+// from the last one when its words ran any.
+extern uint64_t substitutions_run;
+
+#endif // GOONSH_SUBST_H
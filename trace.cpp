@@ -0,0 +1,78 @@
+#include "trace.h"
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <vector>
+
+bool trace_on = false;
+bool startup_profile_on = false;
+
+namespace {
+
+FILE* trace_file = nullptr;
+pid_t trace_pid = 0;  // children that inherit the FILE must not write to it
+bool first_event = true;
+
+void trace_close() {
+    if (!trace_file || getpid() != trace_pid) return;
+    std::fputs("\n]\n", trace_file);
+    std::fclose(trace_file);
+    trace_file = nullptr;
+    trace_on = false;
+}
+
+struct StartupPhase {
+    const char* name;
+    int64_t us;
+};
+
+int64_t startup_begin = 0;
+int64_t startup_last = 0;
+std::vector<StartupPhase> startup_phases;
+
+} // namespace
+
+void trace_init() {
+    const char* path = getenv("DGSH_TRACE");
+    if (!path || !*path) return;
+    trace_file = std::fopen(path, "we");
+    if (!trace_file) {
+        std::perror(path);
+        return;
+    }
+    // Events are small and frequent; let stdio batch them
+    std::setvbuf(trace_file, nullptr, _IOFBF, 1 << 16);
+    std::fputs("[", trace_file);
+    trace_pid = getpid();
+    trace_on = true;
+    std::atexit(trace_close);
+}
+
+void trace_event(const char* name, int64_t start_us, int64_t end_us) {
+    if (!trace_file) return;
+    std::fprintf(trace_file, "%s\n{\"name\":\"%s\",\"cat\":\"dgsh\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":1}",
+                 first_event ? "" : ",", name, static_cast<long long>(start_us),
+                 static_cast<long long>(end_us - start_us), static_cast<int>(trace_pid));
+    first_event = false;
+}
+
+void startup_profile_begin() {
+    startup_profile_on = true;
+    startup_begin = startup_last = trace_now_us();
+}
+
+void startup_mark(const char* phase) {
+    if (!startup_profile_on) return;
+    int64_t now = trace_now_us();
+    startup_phases.push_back({phase, now - startup_last});
+    startup_last = now;
+}
+
+void startup_profile_report(const char* until) {
+    if (!startup_profile_on) return;
+    int64_t total = trace_now_us() - startup_begin;
+    for (const auto& p : startup_phases) std::fprintf(stderr, "startup: %-16s %9.3f ms\n", p.name, p.us / 1000.0);
+    std::fprintf(stderr, "startup: %-16s %9.3f ms  (main to %s)\n", "total", total / 1000.0, until);
+    startup_phases.clear();
+    startup_profile_on = false;
+}
@@ -0,0 +1,51 @@
+#ifndef GOONSH_TRACE_H
+#define GOONSH_TRACE_H
+
+#include <chrono>
+#include <cstdint>
+
+// Opt-in shell overhead tracing. With DGSH_TRACE=FILE in the environment,
+// every phase dgsh spends time in (readline, parse, expand, heredoc,
+// builtin, spawn, wait) is written to FILE as a Chrome trace-event JSON
+// array; load it in chrome://tracing or ui.perfetto.dev. When tracing is
+// off a span costs one branch.
+
+extern bool trace_on;
+
+// Start tracing to `path` if DGSH_TRACE is set. Call once from main().
+void trace_init();
+// Record a complete event; `start_us`/`end_us` from trace_now_us().
+void trace_event(const char* name, int64_t start_us, int64_t end_us);
+
+inline int64_t trace_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Times the enclosing scope as one event named `name` (a string literal).
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) : name(name), start(trace_on ? trace_now_us() : 0) {}
+    ~TraceSpan() {
+        if (trace_on) trace_event(name, start, trace_now_us());
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    int64_t start;
+};
+
+// `dgsh --startup-profile`: where the time from main() to the first prompt
+// (or, running a script, to exit) went, one line per phase on stderr.
+// Phases are consecutive: each mark ends the one before it.
+extern bool startup_profile_on;
+
+void startup_profile_begin();
+void startup_mark(const char* phase);
+// Print the phases and the total, then stop profiling.
+void startup_profile_report(const char* until);
+
+#endif // GOONSH_TRACE_H
@@ -1,119 +1,86 @@
 #include "utils.h"
+#include "dircache.h"
+#include "fuzzy.h"
+#include "parser.h"
+#include "expand.h"
 #include <cstdlib>
 #include <string>
 #include <vector>
 #include <algorithm>
-#include <dirent.h>
-#include <sys/stat.h>
-#include <regex>
 #include <sstream>
-#include <dirent.h>
-#include <algorithm>
 
 std::vector<std::string> split(const std::string& line) {
-    std::vector<std::string> tokens;
-    std::string token;
-    bool in_single = false, in_double = false, escape = false;
-    for (size_t i = 0; i < line.size(); ++i) {
-        char c = line[i];
-        if (escape) {
-            token += c;
-            escape = false;
-        } else if (c == '\\') {
-            escape = true;
-        } else if (c == '"' && !in_single) {
-            in_double = !in_double;
-        } else if (c == '\'' && !in_double) {
-            in_single = !in_single;
-        } else if (isspace(c) && !in_single && !in_double) {
-            if (!token.empty()) {
-                tokens.push_back(token);
-                token.clear();
-            }
-        } else {
-            token += c;
-        }
+    static thread_local std::vector<Token> tokens;
+    lex_line(line, tokens);
+    std::vector<std::string> words;
+    words.reserve(tokens.size());
+    for (const auto& t : tokens) {
+        words.push_back(t.kind == TokKind::Word ? word_value({t.text, t.flags}) : std::string(t.text));
     }
-    if (!token.empty()) tokens.push_back(token);
-    return tokens;
+    return words;
 }
 
 std::string expand_envvars(const std::string& input) {
     std::string result;
-    std::regex env_re(R"(\$([A-Za-z_][A-Za-z0-9_]*))");
-    std::sregex_iterator it(input.begin(), input.end(), env_re), end;
-    size_t last = 0;
-    for (; it != end; ++it) {
-        result += input.substr(last, it->position() - last);
-        const char* val = getenv((*it)[1].str().c_str());
-        if (val) result += val;
-        last = it->position() + it->length();
-    }
-    result += input.substr(last);
+    result.reserve(input.size());
+    expand_vars_into(input, result);
     return result;
 }
 
 std::string expand_path(const std::string& path) {
-    std::string p = path;
-    if (!p.empty() && p[0] == '~') {
+    std::string p;
+    size_t start = 0;
+    if (!path.empty() && path[0] == '~') {
         const char* home = getenv("HOME");
-        if (home) p = std::string(home) + p.substr(1);
+        if (home) {
+            p = home;
+            start = 1;
+        }
     }
-    p = expand_envvars(p);
+    expand_vars_into(std::string_view(path).substr(start), p);
     return p;
 }
 
-std::vector<std::string> get_files(const std::string& prefix) {
-    std::vector<std::string> files;
-    std::string expanded_prefix = expand_path(prefix);
-    std::string dir = ".";
-    std::string file_prefix = expanded_prefix;
-    auto slash = expanded_prefix.rfind('/');
-    std::string user_prefix = prefix;
-    if (slash != std::string::npos) {
-        dir = expanded_prefix.substr(0, slash);
-        file_prefix = expanded_prefix.substr(slash+1);
-        user_prefix = prefix.substr(0, prefix.rfind('/')+1);
-    } else {
+// Split a typed path into the directory to list, the part of the name
+// typed so far, and the text to put back in front of each completion.
+static void split_completion_path(const std::string& typed, std::string& dir, std::string& name,
+                                  std::string& user_prefix) {
+    std::string expanded = expand_path(typed);
+    auto slash = expanded.rfind('/');
+    if (slash == std::string::npos) {
+        dir = ".";
+        name = expanded;
         user_prefix = "";
+        return;
     }
-    DIR* d = opendir(dir.c_str());
-    if (!d) return files;
-    struct dirent* entry;
-    while ((entry = readdir(d))) {
-        std::string name = entry->d_name;
-        if (name.find(file_prefix) == 0) {
-            std::string fullpath = dir + "/" + name;
-            struct stat st;
-            if (stat(fullpath.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
-                files.push_back(user_prefix + name + "/");
-            } else {
-                files.push_back(user_prefix + name);
-            }
-        }
+    dir = expanded.substr(0, slash);
+    name = expanded.substr(slash+1);
+    user_prefix = typed.substr(0, typed.rfind('/')+1);
+    if (dir.empty()) dir = "/";
+}
+
+std::vector<std::string> get_files(const std::string& prefix, size_t limit) {
+    std::vector<std::string> files;
+    std::string dir, file_prefix, user_prefix;
+    split_completion_path(prefix, dir, file_prefix, user_prefix);
+    auto range = dircache_prefix(dircache_list(dir), file_prefix);
+    for (auto it = range.first; it != range.second && files.size() < limit; ++it) {
+        files.push_back(user_prefix + it->name + (it->is_dir ? "/" : ""));
     }
-    closedir(d);
-    std::sort(files.begin(), files.end());
     return files;
 }
 
-std::vector<std::string> get_path_commands() {
-    std::vector<std::string> cmds;
-    char* path = getenv("PATH");
-    if (!path) return cmds;
-    std::istringstream iss(path);
-    std::string dir;
-    while (std::getline(iss, dir, ':')) {
-        DIR* d = opendir(dir.c_str());
-        if (!d) continue;
-        struct dirent* entry;
-        while ((entry = readdir(d))) {
-            if (entry->d_type == DT_REG || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
-                cmds.push_back(entry->d_name);
-        }
-        closedir(d);
+std::vector<std::string> get_files_fuzzy(const std::string& pattern, size_t limit) {
+    std::string dir, name_pattern, user_prefix;
+    split_completion_path(pattern, dir, name_pattern, user_prefix);
+    const DirListing& listing = dircache_list(dir);
+    std::vector<std::string_view> names;
+    names.reserve(listing.size());
+    for (const auto& e : listing) names.push_back(e.name);
+    std::vector<std::string> files;
+    for (const auto& m : fuzzy_rank(name_pattern, names, limit)) {
+        const DirEntry& e = listing[m.index];
+        files.push_back(user_prefix + e.name + (e.is_dir ? "/" : ""));
     }
-    std::sort(cmds.begin(), cmds.end());
-    cmds.erase(std::unique(cmds.begin(), cmds.end()), cmds.end());
-    return cmds;
+    return files;
 }
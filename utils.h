@@ -1,13 +1,18 @@
 #ifndef GOONSH_UTILS_H
 #define GOONSH_UTILS_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 
+// Words and operators of a line as the shell lexer sees them, quotes removed.
 std::vector<std::string> split(const std::string& line);
 std::string expand_envvars(const std::string& input);
 std::string expand_path(const std::string& path);
-std::vector<std::string> get_files(const std::string& prefix);
-std::vector<std::string> get_path_commands();
+// Sorted completions for a path prefix, at most `limit` of them.
+std::vector<std::string> get_files(const std::string& prefix, size_t limit = SIZE_MAX);
+// The best `limit` fuzzy matches for the last path component, best first.
+std::vector<std::string> get_files_fuzzy(const std::string& pattern, size_t limit);
 
 #endif // GOONSH_UTILS_H